@@ -0,0 +1,361 @@
+#include "AhfDevice.h"
+#include "Trace.h"
+
+#include <QFile>
+
+/*
+ * Сжатие
+ * */
+
+AhfCompressor::AhfCompressor(QIODevice *target, const QString &extension, int level, QObject *parent)
+        : QIODevice(parent), target(target), extension(extension), model(level_params(level)),
+          tree(std::make_unique<Tree>()) {
+    buffer.reserve(AHF_DEVICE_BUFFER_SIZE);
+}
+
+AhfCompressor::~AhfCompressor() {
+    if (isOpen())
+        close();
+}
+
+bool AhfCompressor::open(OpenMode mode) {
+    if (mode.testFlag(ReadOnly)) {
+        setErrorString(tr("AhfCompressor is write-only"));
+        return false;
+    }
+    if (target == nullptr || !target->isWritable()) {
+        setErrorString(tr("Target device is not writable"));
+        return false;
+    }
+
+    buffer.clear();
+    failed = false;
+    output = open_output_bit_stream(this, writeByte);
+    if (output == nullptr) {
+        setErrorString(tr("Out of memory"));
+        return false;
+    }
+
+    initialize_tree(tree.get(), model);
+    write_header(output, {.extension = extension.toStdString(), .flags = 0, .model = model});
+
+    return QIODevice::open(mode | Unbuffered);
+}
+
+void AhfCompressor::close() {
+    if (!isOpen())
+        return;
+
+    finish();
+    QIODevice::close();
+}
+
+bool AhfCompressor::finish() {
+    /*
+     * Запись END_OF_STREAM, последнего неполного байта и остатка буфера.
+     * FALSE, если поток в target неполон. Повторный вызов
+     * только возвращает результат.
+     * */
+
+    if (output != nullptr) {
+        try {
+            TRACE_SCOPE("write");
+            encode_symbol(tree.get(), END_OF_STREAM, output);
+            close_output_bit_file(output);
+        } catch (const std::runtime_error &e) {
+            if (!failed)
+                setErrorString(e.what());
+            failed = true;
+            free((char *) output);
+        }
+        output = nullptr;
+        flushBuffer();
+    }
+
+    return !failed;
+}
+
+bool AhfCompressor::isSequential() const {
+    return true;
+}
+
+const CodecStats &AhfCompressor::statistics() const {
+    return tree->stats;
+}
+
+qint64 AhfCompressor::readData(char *, qint64) {
+    return -1;
+}
+
+qint64 AhfCompressor::writeData(const char *data, qint64 maxSize) {
+    TRACE_SCOPE("encode");
+
+    if (failed || output == nullptr)
+        return -1;
+
+    try {
+        for (qint64 i = 0; i < maxSize; ++i) {
+            auto c = (unsigned char) data[i];
+            encode_symbol(tree.get(), c, output);
+            update_model(tree.get(), c);
+        }
+    } catch (const std::runtime_error &e) {
+        if (!failed)
+            setErrorString(e.what());
+        failed = true;
+        return -1;
+    }
+
+    return maxSize;
+}
+
+int AhfCompressor::writeByte(int c, void *stream) {
+    /*
+     * Байты кода копятся во внутреннем буфере и передаются
+     * в target, как только буфер заполнится, и в finish()
+     * */
+
+    auto device = static_cast<AhfCompressor *>(stream);
+    device->buffer.append((char) c);
+    if (device->buffer.size() >= AHF_DEVICE_BUFFER_SIZE && !device->flushBuffer())
+        return EOF;
+    return c;
+}
+
+bool AhfCompressor::flushBuffer() {
+    TRACE_SCOPE("write");
+
+    if (buffer.isEmpty())
+        return true;
+
+    auto written = target->write(buffer);
+    if (written != buffer.size()) {
+        if (!failed)
+            setErrorString(tr("Error writing to target device: ") + target->errorString());
+        failed = true;
+        return false;
+    }
+    buffer.clear();
+    return true;
+}
+
+/*
+ * Распаковка
+ * */
+
+AhfDecompressor::AhfDecompressor(QIODevice *source, QObject *parent)
+        : QIODevice(parent), source(source), tree(std::make_unique<Tree>()) {
+    buffer.reserve(AHF_DEVICE_BUFFER_SIZE);
+    if (source != nullptr) {
+        connect(source, &QIODevice::readyRead, this, &QIODevice::readyRead);
+        connect(source, &QIODevice::readChannelFinished, this, [this] {
+            sourceFinished = true;
+            emit readyRead();
+        });
+    }
+}
+
+AhfDecompressor::~AhfDecompressor() {
+    if (isOpen())
+        close();
+}
+
+bool AhfDecompressor::open(OpenMode mode) {
+    if (mode.testFlag(WriteOnly)) {
+        setErrorString(tr("AhfDecompressor is read-only"));
+        return false;
+    }
+    if (source == nullptr || !source->isReadable()) {
+        setErrorString(tr("Source device is not readable"));
+        return false;
+    }
+
+    buffer.clear();
+    position = 0;
+    headerRead = false;
+    input = open_input_bit_stream(this, readByte);
+    if (input == nullptr) {
+        setErrorString(tr("Out of memory"));
+        return false;
+    }
+
+    finished = false;
+    if (!readHeader() && finished) {
+        close_input_bit_file(input);
+        input = nullptr;
+        return false;
+    }
+
+    return QIODevice::open(mode);
+}
+
+bool AhfDecompressor::readHeader() {
+    /*
+     * Разбор заголовка, когда он пришел целиком.
+     * FALSE - заголовка еще нет или он испорчен (тогда finished).
+     * */
+
+    fillBuffer();
+    auto data = reinterpret_cast<const unsigned char *>(buffer.constData()) + position;
+    if (!header_ready(data, buffer.size() - position) && !inputComplete())
+        return false;
+
+    try {
+        auto header = read_header(input);
+        storedExtension = QString::fromStdString(header.extension);
+        /* Словарь пакета ищется рядом с исходным файлом, если source - файл */
+        auto file = qobject_cast<QFile *>(source);
+        initialize_decoder(&decoder, tree.get(), input, header,
+                           file != nullptr ? file->fileName().toStdString() : std::string());
+    } catch (const std::runtime_error &e) {
+        setErrorString(e.what());
+        finished = true;
+        return false;
+    }
+
+    headerRead = true;
+    return true;
+}
+
+void AhfDecompressor::close() {
+    if (!isOpen())
+        return;
+
+    QIODevice::close();
+    if (input != nullptr)
+        close_input_bit_file(input);
+    input = nullptr;
+}
+
+bool AhfDecompressor::isSequential() const {
+    return true;
+}
+
+bool AhfDecompressor::atEnd() const {
+    return finished && QIODevice::atEnd();
+}
+
+QString AhfDecompressor::extension() const {
+    return storedExtension;
+}
+
+const CodecStats &AhfDecompressor::statistics() const {
+    return tree->stats;
+}
+
+qint64 AhfDecompressor::readData(char *data, qint64 maxSize) {
+    TRACE_SCOPE("decode");
+
+    if (finished)
+        return -1;
+    if (!headerRead && !readHeader())
+        return finished ? -1 : 0;
+
+    qint64 count = 0;
+    try {
+        int c;
+        while (count < maxSize) {
+            if (!inputComplete() && !decoderReady()) {
+                fillBuffer();
+                if (!decoderReady())
+                    break;
+            }
+            if ((c = decode_next(&decoder)) == EOF) {
+                finished = true;
+                returnUnusedInput();
+                break;
+            }
+            data[count++] = (char) c;
+        }
+    } catch (const std::runtime_error &e) {
+        setErrorString(e.what());
+        finished = true;
+        return count > 0 ? count : -1;
+    }
+
+    if (finished) {
+        emit readChannelFinished();
+        if (count == 0)
+            return -1;
+    }
+
+    return count;
+}
+
+qint64 AhfDecompressor::writeData(const char *, qint64) {
+    return -1;
+}
+
+void AhfDecompressor::returnUnusedInput() {
+    /*
+     * После конца архива прочитанные с запасом байты возвращаются
+     * в source, чтобы следующие за архивом данные остались доступны.
+     * Последовательному source байты возвращаются через ungetChar
+     * (работает, если source открыт с буферизацией).
+     * */
+
+    auto unused = buffer.size() - position;
+    if (unused > 0) {
+        if (!source->isSequential())
+            source->seek(source->pos() - unused);
+        else
+            for (auto i = buffer.size(); i > position; --i)
+                source->ungetChar(buffer[i - 1]);
+    }
+    buffer.clear();
+    position = 0;
+}
+
+void AhfDecompressor::fillBuffer() {
+    /*
+     * Перенос в buffer всего, что уже есть в source, без ожидания,
+     * но не больше AHF_DEVICE_BUFFER_SIZE непрочитанных байт
+     * */
+
+    TRACE_SCOPE("read");
+
+    if (position > 0) {
+        buffer.remove(0, position);
+        position = 0;
+    }
+    while (buffer.size() < AHF_DEVICE_BUFFER_SIZE) {
+        auto used = buffer.size();
+        buffer.resize(AHF_DEVICE_BUFFER_SIZE);
+        auto received = source->read(buffer.data() + used, AHF_DEVICE_BUFFER_SIZE - used);
+        buffer.resize(used + (received > 0 ? received : 0));
+        if (received <= 0)
+            break;
+    }
+}
+
+bool AhfDecompressor::decoderReady() const {
+    auto unused = reinterpret_cast<const unsigned char *>(buffer.constData()) + position;
+    return decoder_ready(&decoder, unused, buffer.size() - position);
+}
+
+bool AhfDecompressor::inputComplete() const {
+    /*
+     * TRUE, если новых данных в source уже не будет сверх того,
+     * что read() отдает сразу: произвольный доступ, файл
+     * (чтение блокирующее) или поток после readChannelFinished
+     * */
+
+    return !source->isSequential() || sourceFinished || qobject_cast<QFile *>(source) != nullptr;
+}
+
+int AhfDecompressor::readByte(void *stream) {
+    /*
+     * Байты кода читаются из buffer, пополняемого из source без ожидания.
+     * Для незавершенного потока readData вызывает декодер, только когда
+     * байт хватает (decoder_ready), поэтому EOF здесь - конец данных.
+     * */
+
+    auto device = static_cast<AhfDecompressor *>(stream);
+    if (device->position == device->buffer.size()) {
+        device->fillBuffer();
+        if (device->buffer.isEmpty())
+            return EOF;
+    }
+
+    return (unsigned char) device->buffer[device->position++];
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#ifndef ZFCD_AHFDEVICE_H
+#define ZFCD_AHFDEVICE_H
+
+#include <memory>
+
+#include <QIODevice>
+#include <QByteArray>
+#include <QString>
+
+#include "HuffAdapt.h"
+
+#define AHF_DEVICE_BUFFER_SIZE 0x10000 // Размер внутренних буферов обмена с нижележащим устройством
+
+class AhfCompressor final : public QIODevice {
+    /*
+     * Сжатие на лету: данные, записанные в устройство, кодируются
+     * и в формате .ahf передаются в target блоками не больше
+     * AHF_DEVICE_BUFFER_SIZE. Поток завершается маркером END_OF_STREAM
+     * в finish() или close(); узнать, дошел ли конец потока до target,
+     * можно только по результату finish().
+     * Данные заранее неизвестны, поэтому LEVEL_BEST сжимает
+     * с параметрами LEVEL_NORMAL.
+     * */
+Q_OBJECT
+public:
+    explicit AhfCompressor(QIODevice *target, const QString &extension = {}, int level = DEFAULT_COMPRESSION_LEVEL,
+                           QObject *parent = nullptr);
+
+    ~AhfCompressor() override;
+
+    bool open(OpenMode mode) override;
+
+    void close() override;
+
+    bool finish();
+
+    bool isSequential() const override;
+
+    const CodecStats &statistics() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    QIODevice *target;
+    QString extension;
+    ModelParams model;
+    std::unique_ptr<Tree> tree;
+    BIT_FILE *output = nullptr;
+    QByteArray buffer;
+    bool failed = false; /* Запись в target не удалась, причина в errorString() */
+
+    static int writeByte(int c, void *stream);
+
+    bool flushBuffer();
+};
+
+class AhfDecompressor final : public QIODevice {
+    /*
+     * Распаковка на лету: при чтении из устройства данные .ahf
+     * берутся из source и декодируются по мере запроса.
+     * Чтение не ждет данных: если пришедшего из последовательного
+     * source не хватает на следующую запись (decoder_ready), read()
+     * возвращает 0, и чтение продолжается после следующего readyRead.
+     * Нехватка данных считается ошибкой, только когда source закончился
+     * (readChannelFinished) или не последовательный.
+     * Если заголовок еще не пришел, open() откладывает его разбор,
+     * и extension() пуст до первого прочитанного байта.
+     * Source читается ровно до конца архива, данные после него
+     * остаются в source.
+     * */
+Q_OBJECT
+public:
+    explicit AhfDecompressor(QIODevice *source, QObject *parent = nullptr);
+
+    ~AhfDecompressor() override;
+
+    bool open(OpenMode mode) override;
+
+    void close() override;
+
+    bool isSequential() const override;
+
+    bool atEnd() const override;
+
+    QString extension() const;
+
+    const CodecStats &statistics() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    QIODevice *source;
+    QString storedExtension;
+    std::unique_ptr<Tree> tree;
+    BIT_FILE *input = nullptr;
+    Decoder decoder{};
+    QByteArray buffer;
+    qsizetype position = 0;
+    bool headerRead = false;
+    bool sourceFinished = false; /* Source прислал readChannelFinished */
+    bool finished = false;
+
+    bool readHeader();
+
+    void fillBuffer();
+
+    bool decoderReady() const;
+
+    bool inputComplete() const;
+
+    void returnUnusedInput();
+
+    static int readByte(void *stream);
+};
+
+#endif //ZFCD_AHFDEVICE_H
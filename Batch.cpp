@@ -0,0 +1,500 @@
+#include "Batch.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+static bool used_by_jobs(const std::vector<std::unique_ptr<BatchJob>> &queued, const std::string &filename) {
+    /*
+     * TRUE, если файл читает или пишет незавершенное задание
+     * */
+
+    auto path = std::filesystem::absolute(filename).lexically_normal();
+    for (const auto &job: queued) {
+        if (job->state == JOB_DONE || job->state == JOB_FAILED)
+            continue;
+        if (std::filesystem::absolute(job->filename).lexically_normal() == path ||
+            std::filesystem::absolute(job->output_filename).lexically_normal() == path)
+            return true;
+    }
+    return false;
+}
+
+std::unique_ptr<BatchJob> make_batch_job(const std::string &filename, bool deduplicate, int level,
+                                         const std::vector<std::unique_ptr<BatchJob>> &queued) {
+    /*
+     * Имя результата выбирается при постановке в очередь, чтобы два
+     * задания никогда не писали один файл. Если обычное имя (стем + .ahf)
+     * уже занято, например app.log.1 и app.log.2, к полному имени файла
+     * добавляется .ahf, а расширение в заголовке остается пустым -
+     * распаковка вернет то же полное имя.
+     * */
+
+    std::error_code error;
+    auto size = std::filesystem::file_size(filename, error);
+    if (error)
+        throw std::runtime_error("Can't open file\n");
+    if (used_by_jobs(queued, filename))
+        throw std::runtime_error("File is used by another job in the queue.\n");
+
+    auto job = std::make_unique<BatchJob>();
+    job->filename = filename;
+    job->decode = std::filesystem::path(filename).extension() == ".ahf";
+    job->deduplicate = deduplicate && !job->decode;
+    job->level = level;
+    job->model = level_params(level);
+    job->total_bytes = size;
+
+    if (job->decode) {
+        BIT_FILE *input = open_input_bit_file(filename.c_str());
+        if (input == nullptr)
+            throw std::runtime_error("Can't open file\n");
+        try {
+            job->extension = read_header(input).extension;
+        } catch (const std::runtime_error &) {
+            close_input_bit_file(input);
+            throw;
+        }
+        close_input_bit_file(input);
+        job->output_filename = target_filename(filename, job->extension);
+    } else {
+        job->extension = std::filesystem::path(filename).extension().string().erase(0, 1);
+        job->output_filename = target_filename(filename, "ahf");
+        if (used_by_jobs(queued, job->output_filename)) {
+            job->extension.clear();
+            job->output_filename = filename + ".ahf";
+        }
+    }
+    if (used_by_jobs(queued, job->output_filename))
+        throw std::runtime_error("Output file " + job->output_filename + " is used by another job in the queue.\n");
+
+    return job;
+}
+
+static void fail_job(BatchJob *job, const std::string &message) {
+    /*
+     * Первая ошибка останавливает задание, недописанный файл удаляется
+     * */
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (job->state == JOB_FAILED)
+        return;
+
+    job->error = message;
+    while (!job->error.empty() && job->error.back() == '\n')
+        job->error.pop_back();
+    if (job->output != nullptr) {
+        fclose(job->output);
+        job->output = nullptr;
+    }
+    std::error_code error;
+    if (job->output_created)
+        std::filesystem::remove(job->output_filename, error);
+    job->state = JOB_FAILED;
+}
+
+static int append_byte(int c, void *stream) {
+    static_cast<std::vector<unsigned char> *>(stream)->push_back((unsigned char) c);
+    return c;
+}
+
+static void commit_segment(BatchJob *job, size_t index, std::vector<unsigned char> &&data) {
+    /*
+     * Запись готовых сегментов в выходной файл строго по порядку.
+     * Заголовок выровнен на байт, поэтому пишется перед сегментами как есть.
+     * */
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (job->state == JOB_FAILED)
+        return;
+
+    job->segments[index] = std::move(data);
+    job->segment_ready[index] = true;
+
+    if (job->output == nullptr) {
+        job->output = fopen(job->output_filename.c_str(), "wb");
+        if (job->output == nullptr)
+            throw std::runtime_error("Error open target file.\n");
+        job->output_created = true;
+
+        ArchiveHeader archive_header{.extension = job->extension,
+                                     .flags = job->deduplicate ? AHF_FLAG_DEDUP : 0u,
+                                     .model = job->model,
+                                     .segments = (uint_fast32_t) job->segments.size()};
+        if (job->dictionary) {
+            /* Словарь лежит рядом с архивом, в заголовке только его имя */
+            std::filesystem::path dictionary(job->dictionary_filename);
+            if (dictionary.parent_path() != std::filesystem::absolute(job->output_filename).parent_path())
+                throw std::runtime_error("Dictionary is not in the directory of the archive.\n");
+            archive_header.dictionary = dictionary.filename().string();
+            archive_header.dictionary_size = job->dictionary->data.size();
+            archive_header.dictionary_checksum = job->dictionary->checksum;
+        }
+
+        std::vector<unsigned char> header;
+        BIT_FILE *header_output = open_output_bit_stream(&header, append_byte);
+        write_header(header_output, archive_header);
+        close_output_bit_file(header_output);
+        if (fwrite(header.data(), 1, header.size(), job->output) != header.size())
+            throw std::runtime_error("Error on output.\n");
+    }
+
+    while (job->next_segment < job->segments.size() && job->segment_ready[job->next_segment]) {
+        auto &segment = job->segments[job->next_segment];
+        if (fwrite(segment.data(), 1, segment.size(), job->output) != segment.size())
+            throw std::runtime_error("Error on output.\n");
+        std::vector<unsigned char>().swap(segment);
+        ++job->next_segment;
+    }
+
+    if (job->next_segment == job->segments.size()) {
+        if (fclose(job->output) != 0) {
+            job->output = nullptr;
+            throw std::runtime_error("Error on close compressed file.\n");
+        }
+        job->output = nullptr;
+        job->state = JOB_DONE;
+    }
+}
+
+static void encode_segment(BatchJob *job, size_t index) {
+    TRACE_SCOPE("segment");
+    TRACE_BLOCK((int64_t) index);
+
+    int expected = JOB_QUEUED;
+    job->state.compare_exchange_strong(expected, JOB_RUNNING);
+    if (job->state == JOB_FAILED)
+        return;
+
+    try {
+        uint_fast64_t offset = (uint_fast64_t) index * BATCH_SEGMENT_SIZE;
+        uint_fast64_t length = std::min<uint_fast64_t>(BATCH_SEGMENT_SIZE, job->total_bytes - offset);
+        if (job->deduplicate) {
+            auto [first, last] = job->segment_records[index];
+            offset = first < last ? job->records[first].offset : job->total_bytes;
+            length = 0;
+            for (auto i = first; i < last; ++i)
+                length += job->records[i].length;
+        }
+
+        std::ifstream input(job->filename, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("Error open source file.\n");
+        input.seekg((std::streamoff) offset);
+
+        std::vector<unsigned char> data;
+        data.reserve(length / 2);
+        BIT_FILE *output = open_output_bit_stream(&data, append_byte);
+        if (output == nullptr)
+            throw std::runtime_error("Error open target file.\n");
+
+        auto tree = std::make_unique<Tree>();
+        initialize_tree(tree.get(), job->model);
+
+        if (job->deduplicate) {
+            std::vector<unsigned char> chunk;
+            auto [first, last] = job->segment_records[index];
+            for (auto i = first; i < last; ++i) {
+                const auto &record = job->records[i];
+                chunk.resize(record.length);
+                {
+                    TRACE_SCOPE("read");
+                    if (!input.read((char *) chunk.data(), record.length)) {
+                        close_output_bit_file(output);
+                        throw std::runtime_error("Error on input.\n");
+                    }
+                }
+                encode_chunk(tree.get(), output, record, chunk.data());
+                job->processed_bytes += record.length;
+            }
+            length = 0;
+        }
+
+        std::vector<char> chunk(BATCH_CHUNK_SIZE);
+        while (length > 0) {
+            auto count = (std::streamsize) std::min<uint_fast64_t>(chunk.size(), length);
+            {
+                TRACE_SCOPE("read");
+                if (!input.read(chunk.data(), count)) {
+                    close_output_bit_file(output);
+                    throw std::runtime_error("Error on input.\n");
+                }
+            }
+            for (std::streamsize i = 0; i < count; ++i) {
+                auto c = (unsigned char) chunk[i];
+                encode_symbol(tree.get(), c, output);
+                update_model(tree.get(), c);
+            }
+            length -= count;
+            job->processed_bytes += count;
+        }
+        if (job->deduplicate)
+            encode_chunks_end(tree.get(), output);
+        else
+            encode_symbol(tree.get(), END_OF_STREAM, output);
+        close_output_bit_file(output);
+
+        TRACE_SCOPE("write");
+        commit_segment(job, index, std::move(data));
+    } catch (const std::runtime_error &e) {
+        fail_job(job, e.what());
+    }
+}
+
+static void decode_job(BatchJob *job) {
+    TRACE_SCOPE("decode");
+    TRACE_BLOCK(0);
+
+    job->state = JOB_RUNNING;
+
+    BIT_FILE *input = open_input_bit_file(job->filename.c_str());
+    if (input == nullptr) {
+        fail_job(job, "Error open source file.");
+        return;
+    }
+
+    try {
+        auto header = read_header(input);
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->output = fopen(job->output_filename.c_str(), "wb");
+            if (job->output == nullptr)
+                throw std::runtime_error("Error open target file.\n");
+            job->output_created = true;
+        }
+
+        auto tree = std::make_unique<Tree>();
+        Decoder decoder;
+        initialize_decoder(&decoder, tree.get(), input, header, job->filename);
+
+        int c;
+        while ((c = decode_next(&decoder)) != EOF) {
+            {
+                TRACE_SCOPE_SAMPLED("write");
+                if (putc(c, job->output) == EOF)
+                    throw std::runtime_error("Error on output.\n");
+            }
+
+            if ((decoder.position & (BATCH_CHUNK_SIZE - 1)) == 0)
+                job->processed_bytes = input->byte_counter;
+        }
+
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if (fclose(job->output) != 0) {
+            job->output = nullptr;
+            throw std::runtime_error("Error on output.\n");
+        }
+        job->output = nullptr;
+        job->processed_bytes = job->total_bytes;
+        job->state = JOB_DONE;
+    } catch (const std::runtime_error &e) {
+        fail_job(job, e.what());
+    }
+
+    close_input_bit_file(input);
+}
+
+static void submit_segments(WorkStealingPool *pool, BatchJob *job, size_t segment_count) {
+    job->segments.resize(segment_count);
+    job->segment_ready.assign(segment_count, false);
+
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < segment_count; ++i)
+        tasks.emplace_back([job, i] { encode_segment(job, i); });
+    pool->submit(std::move(tasks));
+}
+
+static size_t segment_count(BatchJob *job) {
+    return std::max<uint_fast64_t>(1, (job->total_bytes + BATCH_SEGMENT_SIZE - 1) / BATCH_SEGMENT_SIZE);
+}
+
+static void plan_records(WorkStealingPool *pool, BatchJob *job) {
+    /*
+     * План дедупликации строится последовательно по всему файлу,
+     * затем записи группируются в сегменты примерно по BATCH_SEGMENT_SIZE
+     * */
+
+    try {
+        if (job->deduplicate)
+            job->records = plan_chunks(job->filename, nullptr, job->dictionary.get());
+    } catch (const std::runtime_error &e) {
+        fail_job(job, e.what());
+        return;
+    }
+
+    if (!job->deduplicate) {
+        submit_segments(pool, job, segment_count(job));
+        return;
+    }
+
+    /* Без ссылок в словарь архив не должен от него зависеть */
+    if (std::none_of(job->records.begin(), job->records.end(), [](const ChunkRecord &record) {
+        return record.distance == DEDUP_DICTIONARY_REFERENCE;
+    }))
+        job->dictionary = nullptr;
+
+    size_t first = 0;
+    uint_fast64_t size = 0;
+    for (size_t i = 0; i < job->records.size(); ++i) {
+        size += job->records[i].length;
+        if (size >= BATCH_SEGMENT_SIZE) {
+            job->segment_records.emplace_back(first, i + 1);
+            first = i + 1;
+            size = 0;
+        }
+    }
+    if (first < job->records.size() || job->segment_records.empty())
+        job->segment_records.emplace_back(first, job->records.size());
+
+    submit_segments(pool, job, job->segment_records.size());
+}
+
+static void plan_job(WorkStealingPool *pool, BatchJob *job) {
+    /*
+     * Для LEVEL_BEST варианты модели пробуются отдельными задачами
+     * этого же пула, последняя завершившаяся выбирает параметры
+     * и продолжает планирование. Вложенный пул (choose_model_params)
+     * создавал бы по потоку на ядро в каждом рабочем потоке
+     * */
+
+    job->state = JOB_RUNNING;
+    if (job->level != LEVEL_BEST) {
+        plan_records(pool, job);
+        return;
+    }
+
+    try {
+        TRACE_SCOPE("choose_model_params");
+        job->trial = prepare_model_trial(job->filename);
+    } catch (const std::runtime_error &e) {
+        fail_job(job, e.what());
+        return;
+    }
+
+    job->trial_left = job->trial.bits.size();
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < job->trial.bits.size(); ++i)
+        tasks.emplace_back([pool, job, i] {
+            TRACE_SCOPE("model_trial");
+            TRACE_BLOCK((int64_t) i);
+            run_model_trial(&job->trial, i);
+            if (--job->trial_left == 0) {
+                job->model = best_model_trial(job->trial);
+                job->trial = {};
+                plan_records(pool, job);
+            }
+        });
+    pool->submit(std::move(tasks));
+}
+
+void submit_batch_job(WorkStealingPool *pool, BatchJob *job) {
+    /*
+     * Постановка задания в пул потоков
+     * */
+
+    if (job->decode)
+        pool->submit({[job] { decode_job(job); }});
+    else if (job->deduplicate || job->level == LEVEL_BEST)
+        pool->submit({[pool, job] { plan_job(pool, job); }});
+    else
+        submit_segments(pool, job, segment_count(job));
+}
+
+static void write_dictionary(const DedupDictionary &dictionary, const std::string &filename) {
+    /*
+     * Словарь пишется обычным сжатым файлом без расширения в заголовке.
+     * Кодируется в память, чтобы при ошибке не оставить недописанный файл.
+     * */
+
+    TRACE_SCOPE("write");
+
+    std::vector<unsigned char> data;
+    BIT_FILE *output = open_output_bit_stream(&data, append_byte);
+    if (output == nullptr)
+        throw std::runtime_error("Error open target file.\n");
+
+    auto tree = std::make_unique<Tree>();
+    initialize_tree(tree.get());
+    write_header(output, {});
+    for (auto c: dictionary.data) {
+        encode_symbol(tree.get(), c, output);
+        update_model(tree.get(), c);
+    }
+    encode_symbol(tree.get(), END_OF_STREAM, output);
+    close_output_bit_file(output);
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (file == nullptr)
+        throw std::runtime_error("Error open target file.\n");
+    auto written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    if (fclose(file) != 0 || !written) {
+        std::error_code error;
+        std::filesystem::remove(filename, error);
+        throw std::runtime_error("Error on output.\n");
+    }
+}
+
+static void share_dictionary(const std::vector<BatchJob *> &jobs) {
+    /*
+     * Словарь записывается в общий каталог результатов заданий,
+     * имя - по CRC-32 содержимого. Если общих фрагментов нет или словарь
+     * не удалось построить, задания сжимаются как по отдельности.
+     * */
+
+    std::vector<std::string> filenames;
+    for (auto job: jobs)
+        filenames.push_back(job->filename);
+
+    try {
+        auto dictionary = std::make_shared<DedupDictionary>(build_dictionary(filenames));
+        if (dictionary->data.empty())
+            return;
+
+        char name[32];
+        snprintf(name, sizeof(name), "zfcd-dictionary-%08x.ahf", (unsigned) dictionary->checksum);
+        auto filename = (std::filesystem::absolute(jobs.front()->output_filename).parent_path() / name).string();
+        write_dictionary(*dictionary, filename);
+
+        for (auto job: jobs) {
+            job->dictionary = dictionary;
+            job->dictionary_filename = filename;
+        }
+    } catch (const std::runtime_error &) {
+        for (auto job: jobs)
+            job->dictionary = nullptr;
+    }
+}
+
+void submit_batch_run(WorkStealingPool *pool, const std::vector<BatchJob *> &jobs) {
+    /*
+     * Постановка заданий, запущенных вместе. Сжатия с дедупликацией
+     * группируются по каталогу результата: архив ссылается только на словарь
+     * в своем каталоге. Для группы больше чем из одного задания сначала
+     * отдельной задачей строится общий словарь, и только после него
+     * планируются ее задания.
+     * */
+
+    std::map<std::filesystem::path, std::vector<BatchJob *>> groups;
+    for (auto job: jobs) {
+        if (job->deduplicate)
+            groups[std::filesystem::absolute(job->output_filename).parent_path()].push_back(job);
+        else
+            submit_batch_job(pool, job);
+    }
+
+    for (auto &[directory, shared]: groups) {
+        if (shared.size() < 2) {
+            submit_batch_job(pool, shared.front());
+            continue;
+        }
+
+        pool->submit({[pool, shared] {
+            share_dictionary(shared);
+            for (auto job: shared)
+                submit_batch_job(pool, job);
+        }});
+    }
+}
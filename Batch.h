@@ -0,0 +1,74 @@
+#pragma once
+
+#ifndef ZFCD_BATCH_H
+#define ZFCD_BATCH_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "HuffAdapt.h"
+#include "Dedup.h"
+#include "WorkStealingPool.h"
+
+#define BATCH_SEGMENT_SIZE (4 << 20) // Размер сегмента, на которые делится большой файл при сжатии
+#define BATCH_CHUNK_SIZE 0x10000     // Шаг чтения и обновления прогресса
+
+enum JOB_STATES {
+    JOB_QUEUED, JOB_RUNNING, JOB_DONE, JOB_FAILED
+};
+
+struct BatchJob {
+    /*
+     * Задание пакетной обработки одного файла.
+     * Файлы .ahf распаковываются одной задачей, остальные сжимаются
+     * сегментами по BATCH_SEGMENT_SIZE с независимой моделью, которые
+     * можно кодировать параллельно. Сегменты записываются в выходной
+     * файл по порядку, по мере готовности.
+     * С дедупликацией сначала одной задачей строится план фрагментов
+     * для всего файла, а сегменты нарезаются по границам записей плана,
+     * так что ссылки могут указывать в предыдущие сегменты.
+     * Для LEVEL_BEST перед планом выбираются параметры модели, общие
+     * для всех сегментов, варианты пробуются отдельными задачами пула.
+     * Задания с дедупликацией, запущенные вместе (submit_batch_run),
+     * ссылаются на общий словарь фрагментов, повторяющихся между файлами.
+     * */
+
+    std::string filename;
+    std::string output_filename; /* Выбирается в make_batch_job и не совпадает с файлами других заданий */
+    std::string extension;       /* Расширение в заголовке .ahf */
+    bool decode;
+    bool deduplicate;
+    int level;
+    ModelParams model;
+    uint_fast64_t total_bytes;                     /* Размер исходного файла */
+    std::atomic<uint_fast64_t> processed_bytes{0}; /* Обработано байт исходного файла */
+    std::atomic<int> state{JOB_QUEUED};
+    std::string error;                             /* Заполняется до перехода в JOB_FAILED */
+
+    std::vector<ChunkRecord> records;                       /* План дедупликации */
+    std::vector<std::pair<size_t, size_t>> segment_records; /* Диапазоны записей плана по сегментам */
+    std::shared_ptr<const DedupDictionary> dictionary;      /* Общий словарь пакета или nullptr */
+    std::string dictionary_filename;                        /* Файл словаря в каталоге результата */
+    ModelTrial trial;                                       /* Проба вариантов модели для LEVEL_BEST */
+    std::atomic<size_t> trial_left{0};                      /* Осталось проб вариантов */
+
+    std::mutex mutex; /* Защищает поля ниже */
+    FILE *output = nullptr;
+    bool output_created = false; /* Выходной файл создан этим заданием и удаляется при ошибке */
+    std::vector<std::vector<unsigned char>> segments;
+    std::vector<bool> segment_ready;
+    size_t next_segment = 0;
+};
+
+std::unique_ptr<BatchJob> make_batch_job(const std::string &filename, bool deduplicate = false,
+                                         int level = DEFAULT_COMPRESSION_LEVEL,
+                                         const std::vector<std::unique_ptr<BatchJob>> &queued = {});
+
+void submit_batch_job(WorkStealingPool *pool, BatchJob *job);
+
+void submit_batch_run(WorkStealingPool *pool, const std::vector<BatchJob *> &jobs);
+
+#endif //ZFCD_BATCH_H
@@ -0,0 +1,310 @@
+#include "Dedup.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <tuple>
+
+#define DEDUP_MASK_S 0x0003590703530000ULL // Маска до средней длины фрагмента (реже разрез)
+#define DEDUP_MASK_L 0x0000d90003530000ULL // Маска после средней длины (чаще разрез)
+
+static const auto gear_table = [] {
+    /*
+     * Таблица Gear хеша: псевдослучайные 64-битные значения (splitmix64)
+     * */
+
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x5A4643445A464344ULL;
+    for (auto &value: table) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        value = z ^ (z >> 31);
+    }
+    return table;
+}();
+
+size_t cdc_cut(const unsigned char *data, size_t size) {
+    /*
+     * Длина очередного фрагмента (нормализованный FastCDC).
+     * Если size меньше DEDUP_MAX_CHUNK, считается, что это конец данных.
+     * */
+
+    if (size <= DEDUP_MIN_CHUNK)
+        return size;
+
+    size_t normal = std::min<size_t>(DEDUP_AVG_CHUNK, size);
+    size_t limit = std::min<size_t>(DEDUP_MAX_CHUNK, size);
+    uint64_t hash = 0;
+    size_t i = DEDUP_MIN_CHUNK;
+
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + gear_table[data[i]];
+        if ((hash & DEDUP_MASK_S) == 0)
+            return i + 1;
+    }
+    for (; i < limit; ++i) {
+        hash = (hash << 1) + gear_table[data[i]];
+        if ((hash & DEDUP_MASK_L) == 0)
+            return i + 1;
+    }
+    return limit;
+}
+
+static uint64_t chunk_hash(const unsigned char *data, size_t size) {
+    /*
+     * FNV-1a, 64 бита. Совпадение хешей перепроверяется сравнением байт.
+     * */
+
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+struct DedupPlanner {
+    /*
+     * Состояние построения плана.
+     * history - кольцевой буфер последних DEDUP_WINDOW байт входа,
+     * те же данные будут у декодера при разрешении ссылок.
+     * */
+
+    std::vector<unsigned char> history;
+    uint_fast64_t position = 0;
+    std::unordered_map<uint64_t, uint_fast64_t> index;       /* Хеш фрагмента -> позиция */
+    std::deque<std::pair<uint_fast64_t, uint64_t>> positions; /* Фрагменты окна по порядку */
+    std::vector<ChunkRecord> records;
+    CodecStats *stats;
+    const DedupDictionary *dictionary; /* Общий словарь пакета или nullptr */
+};
+
+static bool history_equal(const DedupPlanner &planner, uint_fast64_t from, const unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        if (planner.history[(from + i) & (DEDUP_WINDOW - 1)] != data[i])
+            return false;
+    return true;
+}
+
+static void plan_chunk(DedupPlanner &planner, const unsigned char *data, size_t size) {
+    /*
+     * Решение по одному фрагменту: ссылка на копию в окне,
+     * ссылка в словарь или литерал. Соседние записи одного вида
+     * сливаются, ссылки в словарь - если идут в нем подряд.
+     * */
+
+    while (!planner.positions.empty() && planner.positions.front().first + DEDUP_WINDOW < planner.position + size) {
+        auto [old_position, old_hash] = planner.positions.front();
+        auto found = planner.index.find(old_hash);
+        if (found != planner.index.end() && found->second == old_position)
+            planner.index.erase(found);
+        planner.positions.pop_front();
+    }
+
+    auto hash = chunk_hash(data, size);
+    auto found = planner.index.find(hash);
+    uint32_t distance = 0;
+    if (found != planner.index.end() && history_equal(planner, found->second, data, size))
+        distance = (uint32_t) (planner.position - found->second);
+
+    uint32_t dictionary_offset = 0;
+    if (distance == 0 && planner.dictionary != nullptr) {
+        const auto &dictionary = *planner.dictionary;
+        auto shared = dictionary.index.find(hash);
+        if (shared != dictionary.index.end() && shared->second + size <= dictionary.data.size() &&
+            memcmp(dictionary.data.data() + shared->second, data, size) == 0) {
+            distance = DEDUP_DICTIONARY_REFERENCE;
+            dictionary_offset = shared->second;
+        }
+    }
+
+    auto &records = planner.records;
+    if (!records.empty() && records.back().distance == distance &&
+        records.back().length + size <= DEDUP_RECORD_LIMIT &&
+        (distance != DEDUP_DICTIONARY_REFERENCE ||
+         records.back().dictionary_offset + records.back().length == dictionary_offset))
+        records.back().length += size;
+    else
+        records.push_back({planner.position, (uint32_t) size, distance, dictionary_offset});
+
+    if (planner.stats != nullptr) {
+        ++planner.stats->chunks;
+        if (distance != 0) {
+            ++planner.stats->duplicate_chunks;
+            planner.stats->duplicate_bytes += size;
+        }
+        if (distance == DEDUP_DICTIONARY_REFERENCE)
+            planner.stats->dictionary_bytes += size;
+    }
+
+    if (distance == 0) {
+        planner.index[hash] = planner.position;
+        planner.positions.emplace_back(planner.position, hash);
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        auto at = (planner.position + i) & (DEDUP_WINDOW - 1);
+        if (at == planner.history.size())
+            planner.history.push_back(data[i]);
+        else
+            planner.history[at] = data[i];
+    }
+    planner.position += size;
+}
+
+static void for_each_chunk(const std::string &filename,
+                           const std::function<void(const unsigned char *, size_t)> &body) {
+    /*
+     * Чтение файла с разбиением на фрагменты по содержимому
+     * */
+
+    FILE *input = fopen(filename.c_str(), "rb");
+    if (input == nullptr)
+        throw std::runtime_error("Error open source file.\n");
+
+    std::vector<unsigned char> pending(4 * DEDUP_MAX_CHUNK);
+    size_t begin = 0;
+    size_t end = 0;
+    bool eof = false;
+
+    while (true) {
+        if (!eof && end - begin < DEDUP_MAX_CHUNK) {
+            std::copy(pending.begin() + (std::ptrdiff_t) begin, pending.begin() + (std::ptrdiff_t) end, pending.begin());
+            end -= begin;
+            begin = 0;
+            end += fread(pending.data() + end, 1, pending.size() - end, input);
+            eof = end < pending.size();
+            if (eof && ferror(input)) {
+                fclose(input);
+                throw std::runtime_error("Error on input.\n");
+            }
+        }
+        if (begin == end)
+            break;
+
+        auto size = cdc_cut(pending.data() + begin, end - begin);
+        body(pending.data() + begin, size);
+        begin += size;
+    }
+
+    fclose(input);
+}
+
+DedupDictionary build_dictionary(const std::vector<std::string> &filenames) {
+    /*
+     * Первый проход по всем файлам пакета. В словарь попадают фрагменты,
+     * которые есть хотя бы в двух файлах, в порядке первого появления,
+     * так что соседние фрагменты остаются соседними и ссылки на них
+     * сливаются. Повторы внутри одного файла находит окно, словарь
+     * для них не нужен. Размер словаря ограничен DEDUP_DICTIONARY_LIMIT.
+     * */
+
+    TRACE_SCOPE("dedup_dictionary");
+
+    struct Occurrence {
+        size_t first_file; /* Файл и смещение первого появления */
+        uint_fast64_t offset;
+        uint32_t length;
+        size_t last_file;
+        size_t files;      /* В скольких файлах встречен */
+    };
+    std::unordered_map<uint64_t, Occurrence> seen;
+
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        uint_fast64_t offset = 0;
+        for_each_chunk(filenames[i], [&](const unsigned char *data, size_t size) {
+            auto [found, inserted] = seen.try_emplace(chunk_hash(data, size),
+                                                      Occurrence{i, offset, (uint32_t) size, i, 1});
+            if (!inserted && found->second.last_file != i) {
+                found->second.last_file = i;
+                ++found->second.files;
+            }
+            offset += size;
+        });
+    }
+
+    std::vector<std::pair<uint64_t, const Occurrence *>> shared;
+    for (const auto &[hash, occurrence]: seen)
+        if (occurrence.files > 1)
+            shared.emplace_back(hash, &occurrence);
+    std::sort(shared.begin(), shared.end(), [](const auto &a, const auto &b) {
+        return std::tie(a.second->first_file, a.second->offset) < std::tie(b.second->first_file, b.second->offset);
+    });
+
+    DedupDictionary dictionary;
+    std::ifstream input;
+    size_t opened = filenames.size();
+    for (const auto &[hash, occurrence]: shared) {
+        if (dictionary.data.size() + occurrence->length > DEDUP_DICTIONARY_LIMIT)
+            break;
+        if (opened != occurrence->first_file) {
+            opened = occurrence->first_file;
+            input.close();
+            input.open(filenames[opened], std::ios::binary);
+            if (!input.is_open())
+                throw std::runtime_error("Error open source file.\n");
+        }
+
+        /* Смещения 64-битные: fseek с long на Windows ограничен 2 GiB */
+        auto offset = dictionary.data.size();
+        dictionary.data.resize(offset + occurrence->length);
+        if (!input.seekg((std::streamoff) occurrence->offset) ||
+            !input.read((char *) dictionary.data.data() + offset, occurrence->length))
+            throw std::runtime_error("Error on input.\n");
+        dictionary.index[hash] = (uint32_t) offset;
+    }
+
+    for (auto c: dictionary.data)
+        dictionary.checksum = crc32_update(dictionary.checksum, c);
+
+    return dictionary;
+}
+
+std::vector<ChunkRecord> plan_chunks(const std::string &filename, CodecStats *stats,
+                                     const DedupDictionary *dictionary) {
+    /*
+     * Первый проход по файлу: разбиение на фрагменты и поиск повторов.
+     * Ссылки не выходят за окно DEDUP_WINDOW, поэтому декодеру
+     * достаточно помнить столько же последних байт.
+     * Фрагменты, которых нет в окне, ищутся в словаре пакета.
+     * */
+
+    TRACE_SCOPE("dedup_plan");
+
+    DedupPlanner planner;
+    planner.stats = stats;
+    planner.dictionary = dictionary;
+
+    for_each_chunk(filename, [&](const unsigned char *data, size_t size) {
+        plan_chunk(planner, data, size);
+    });
+
+    return std::move(planner.records);
+}
+
+void encode_chunk(Tree *tree, BIT_FILE *output, const ChunkRecord &record, const unsigned char *data) {
+    if (record.distance != 0) {
+        output_bit(output, 1);
+        output_bits(output, record.distance, 32);
+        if (record.distance == DEDUP_DICTIONARY_REFERENCE)
+            output_bits(output, record.dictionary_offset, 32);
+        output_bits(output, record.length, 32);
+        return;
+    }
+
+    output_bit(output, 0);
+    output_bits(output, record.length, 32);
+    for (uint32_t i = 0; i < record.length; ++i) {
+        encode_symbol(tree, data[i], output);
+        update_model(tree, data[i]);
+    }
+}
+
+void encode_chunks_end(Tree *tree, BIT_FILE *output) {
+    output_bit(output, 1);
+    output_bits(output, 0, 32);
+    encode_symbol(tree, END_OF_STREAM, output);
+}
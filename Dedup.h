@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef ZFCD_DEDUP_H
+#define ZFCD_DEDUP_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "HuffAdapt.h"
+
+/*
+ * Дедупликация перед кодированием.
+ * Вход делится на фрагменты переменной длины по содержимому
+ * (Gear хеш, как в FastCDC), повторно встреченный фрагмент
+ * заменяется ссылкой на его предыдущую копию. Через модель
+ * кодируются только уникальные данные.
+ * В пакете из нескольких файлов фрагменты, общие для разных файлов,
+ * собираются в словарь (DedupDictionary), который пишется отдельным
+ * .ahf, и архивы пакета ссылаются на него (AHF_FLAG_DICTIONARY).
+ *
+ * Формат потока с флагом AHF_FLAG_DEDUP: последовательность записей,
+ * каждая начинается с бита признака (без модели):
+ *   0, длина (32 бита), затем длина символов через модель - литерал;
+ *   1, расстояние (32 бита), длина (32 бита) - копия уже декодированных данных;
+ *   1, DEDUP_DICTIONARY_REFERENCE (32 бита), смещение (32 бита), длина (32 бита) -
+ *      копия из словаря, только с AHF_FLAG_DICTIONARY;
+ *   1, расстояние 0 - конец сегмента, за ним END_OF_STREAM.
+ * */
+
+#define DEDUP_MIN_CHUNK 0x800      // 2 KiB
+#define DEDUP_AVG_CHUNK 0x2000     // 8 KiB
+#define DEDUP_MAX_CHUNK 0x10000    // 64 KiB
+#define DEDUP_RECORD_LIMIT 0x1000000 // Соседние записи одного вида объединяются до 16 MiB
+
+struct ChunkRecord {
+    /*
+     * Запись плана дедупликации
+     * */
+
+    uint_fast64_t offset; /* Смещение во входных данных */
+    uint32_t length;      /* Длина */
+    uint32_t distance;    /* Расстояние назад до копии, 0 - литерал */
+    uint32_t dictionary_offset; /* Смещение в словаре, если distance == DEDUP_DICTIONARY_REFERENCE */
+};
+
+struct DedupDictionary {
+    /*
+     * Общий словарь пакета: фрагменты, встреченные больше чем
+     * в одном файле, подряд в порядке первого появления
+     * */
+
+    std::vector<unsigned char> data;
+    std::unordered_map<uint64_t, uint32_t> index; /* Хеш фрагмента -> смещение в data */
+    uint32_t checksum = 0;                        /* CRC-32 data */
+};
+
+size_t cdc_cut(const unsigned char *data, size_t size);
+
+DedupDictionary build_dictionary(const std::vector<std::string> &filenames);
+
+std::vector<ChunkRecord> plan_chunks(const std::string &filename, CodecStats *stats = nullptr,
+                                     const DedupDictionary *dictionary = nullptr);
+
+void encode_chunk(Tree *tree, BIT_FILE *output, const ChunkRecord &record, const unsigned char *data);
+
+void encode_chunks_end(Tree *tree, BIT_FILE *output);
+
+#endif //ZFCD_DEDUP_H
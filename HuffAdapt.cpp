@@ -0,0 +1,1391 @@
+#include "HuffAdapt.h"
+#include "Trace.h"
+#include "WorkStealingPool.h"
+
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <filesystem>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+/*
+ * Побитовый файловый доступ
+ * */
+
+static inline int get_byte(BIT_FILE *compressed_file) {
+    /*
+     * Чтение байта из файла или пользовательского потока.
+     * Чтение пользовательского потока отмечает его владелец (AhfDecompressor)
+     * */
+
+    if (compressed_file->unread != EOF) {
+        int c = compressed_file->unread;
+        compressed_file->unread = EOF;
+        return c;
+    }
+    if (compressed_file->file != NULL) {
+        TRACE_SCOPE_SAMPLED("read");
+        return getc(compressed_file->file);
+    }
+    return compressed_file->read_byte(compressed_file->stream);
+}
+
+static inline int put_byte(int c, BIT_FILE *compressed_file) {
+    /*
+     * Запись байта в файл или пользовательский поток
+     * */
+
+    if (compressed_file->file != NULL)
+        return putc(c, compressed_file->file);
+    return compressed_file->write_byte(c, compressed_file->stream);
+}
+
+BIT_FILE *open_input_bit_file(const char *name) {
+    /*
+     * Открытие файла для побитового ввода
+     * */
+    BIT_FILE *compressed_file;
+
+    compressed_file = (BIT_FILE *)
+            calloc(1, sizeof(BIT_FILE));
+    if (compressed_file == NULL)
+        return (compressed_file);
+    compressed_file->file = fopen(name, "rb");
+    if (compressed_file->file == NULL) {
+        free((char *) compressed_file);
+        return (NULL);
+    }
+    compressed_file->rack = 0;
+    compressed_file->mask = 0x80;
+    compressed_file->byte_counter = 0;
+    compressed_file->unread = EOF;
+    return (compressed_file);
+}
+
+BIT_FILE *open_output_bit_file(const char *name) {
+    /*
+     * Открытие файла для побитового вывода
+     * */
+    BIT_FILE *compressed_file;
+
+    compressed_file = (BIT_FILE *)
+            calloc(1, sizeof(BIT_FILE));
+    if (compressed_file == NULL)
+        return (compressed_file);
+    compressed_file->file = fopen(name, "wb");
+    if (compressed_file->file == NULL) {
+        free((char *) compressed_file);
+        return (NULL);
+    }
+    compressed_file->rack = 0;
+    compressed_file->mask = 0x80;
+    compressed_file->byte_counter = 0;
+    compressed_file->unread = EOF;
+    return (compressed_file);
+}
+
+BIT_FILE *open_input_bit_stream(void *stream, int (*read_byte)(void *stream)) {
+    /*
+     * Побитовый ввод из пользовательского потока.
+     * read_byte возвращает очередной байт или EOF.
+     * */
+    BIT_FILE *compressed_file;
+
+    compressed_file = (BIT_FILE *)
+            calloc(1, sizeof(BIT_FILE));
+    if (compressed_file == NULL)
+        return (compressed_file);
+    compressed_file->stream = stream;
+    compressed_file->read_byte = read_byte;
+    compressed_file->rack = 0;
+    compressed_file->mask = 0x80;
+    compressed_file->byte_counter = 0;
+    compressed_file->unread = EOF;
+    return (compressed_file);
+}
+
+BIT_FILE *open_output_bit_stream(void *stream, int (*write_byte)(int c, void *stream)) {
+    /*
+     * Побитовый вывод в пользовательский поток.
+     * write_byte возвращает записанный байт или EOF при ошибке.
+     * */
+    BIT_FILE *compressed_file;
+
+    compressed_file = (BIT_FILE *)
+            calloc(1, sizeof(BIT_FILE));
+    if (compressed_file == NULL)
+        return (compressed_file);
+    compressed_file->stream = stream;
+    compressed_file->write_byte = write_byte;
+    compressed_file->rack = 0;
+    compressed_file->mask = 0x80;
+    compressed_file->byte_counter = 0;
+    compressed_file->unread = EOF;
+    return (compressed_file);
+}
+
+void output_bit(BIT_FILE *compressed_file, int bit) {
+    /*
+     * Вывод одного бита в файл
+     * */
+
+    if (bit)
+        compressed_file->rack |= compressed_file->mask;
+    compressed_file->mask >>= 1;
+    if (compressed_file->mask == 0) {
+        if (put_byte(compressed_file->rack, compressed_file) !=
+            compressed_file->rack)
+            throw std::runtime_error("Error on output_bit!\n");
+        ++compressed_file->byte_counter;
+        compressed_file->rack = 0;
+        compressed_file->mask = 0x80;
+    }
+}
+
+void output_bits(BIT_FILE *compressed_file, unsigned long code, int bit_count) {
+    /*
+     * Вывод bit_count бит в файл
+     * */
+
+    unsigned long mask;
+
+    mask = 1L << (bit_count - 1);
+    while (mask != 0) {
+        if (mask & code)
+            compressed_file->rack |= compressed_file->mask;
+        compressed_file->mask >>= 1;
+        if (compressed_file->mask == 0) {
+            if (put_byte(compressed_file->rack, compressed_file) !=
+                compressed_file->rack)
+                throw std::runtime_error("Error on output_bits!\n");
+            ++compressed_file->byte_counter;
+            compressed_file->rack = 0;
+            compressed_file->mask = 0x80;
+        }
+        mask >>= 1;
+    }
+}
+
+int input_bit(BIT_FILE *compressed_file) {
+    /*
+     * Ввод одного бита в файл
+     * */
+    int value;
+
+    if (compressed_file->mask == 0x80) {
+        compressed_file->rack = get_byte(compressed_file);
+        if (compressed_file->rack == EOF)
+            throw std::runtime_error("Error on input_bit!\n");
+        ++compressed_file->byte_counter;
+    }
+    value = compressed_file->rack & compressed_file->mask;
+    compressed_file->mask >>= 1;
+    if (compressed_file->mask == 0)
+        compressed_file->mask = 0x80;
+    return (value ? 1 : 0);
+}
+
+unsigned long input_bits(BIT_FILE *compressed_file, int bit_count) {
+    /*
+     * Ввод bit_count бит в файл
+     * */
+    uint_fast32_t mask;
+    uint_fast32_t return_value;
+
+    mask = 1L << (bit_count - 1);
+    return_value = 0;
+    while (mask != 0) {
+        if (compressed_file->mask == 0x80) {
+            compressed_file->rack = get_byte(compressed_file);
+            if (compressed_file->rack == EOF)
+                throw std::runtime_error("Error on input_bits!\n");
+            ++compressed_file->byte_counter;
+        }
+        if (compressed_file->rack & compressed_file->mask)
+            return_value |= mask;
+        mask >>= 1;
+        compressed_file->mask >>= 1;
+        if (compressed_file->mask == 0)
+            compressed_file->mask = 0x80;
+    }
+
+    return return_value;
+}
+
+void close_input_bit_file(BIT_FILE *compressed_file) {
+    /*
+     * Закрытие файла, открытого для побитового ввода
+     * */
+
+    if (compressed_file->file != NULL)
+        fclose(compressed_file->file);
+    free((char *) compressed_file);
+}
+
+void close_output_bit_file(BIT_FILE *compressed_file) {
+    /*
+     * Закрытие файла, открытого для побитового вывода
+     * */
+
+    if (compressed_file->mask != 0x80)
+        if (put_byte(compressed_file->rack, compressed_file) !=
+            compressed_file->rack)
+            throw std::runtime_error("Error on close compressed file.\n");
+    if (compressed_file->file != NULL) {
+        fflush(compressed_file->file);
+        fclose(compressed_file->file);
+    }
+    free((char *) compressed_file);
+}
+
+/*
+ * Сервисные функции
+ * */
+
+uint_fast32_t file_size(const char *name) {
+    /*
+     * Возвращает размер указанного файла в байтах
+     * */
+
+    std::ifstream f(name, std::ios::ate);
+    if (!f.is_open())
+        throw std::runtime_error("Can't open file\n");
+
+    uint_fast32_t size = f.tellg();
+
+    f.close();
+
+    return size;
+}
+
+void print_results(char *input, char *output) {
+    /*
+     * Вывод результатов
+     * */
+
+    uint_fast32_t input_size = file_size(input);
+    if (input_size == 0)
+        input_size = 1;
+
+    printf("\nSource filesize:\t%ld\n", input_size);
+
+    uint_fast32_t output_size = file_size(output);
+    printf("Target Filesize:\t%ld\n", output_size);
+
+    int ratio = 100 - (int) (output_size * 100L / input_size);
+    printf("Compression ratio:\t\t%d%%\n", ratio);
+}
+
+void print_fatal_error(char *fmt) {
+    /*
+     * Вывод сообщения об ошибке
+     * */
+    printf("Fatal error: ");
+    printf("%s", fmt);
+    exit(-1);
+}
+
+void help() {
+    /*
+     * Вывод подсказки по использованию программой
+     * */
+    printf("HuffAdapt e(encoding)|d(decoding) input output\n");
+}
+
+double average_code_length(const CodecStats &stats) {
+    /*
+     * Средняя длина кода в битах на символ
+     * */
+
+    if (stats.symbols == 0)
+        return 0.0;
+
+    return (double) stats.code_bits / (double) stats.symbols;
+}
+
+std::string codec_stats_to_json(const CodecStats &stats) {
+    /*
+     * Сериализация статистики кодека в JSON.
+     * В гистограмме глубин выводятся только непустые ячейки,
+     * из времени этапов - только замеренные (ненулевые).
+     * */
+
+    const char *stage_names[STAGE_COUNT] = {"header", "dedup", "coding", "finalize"};
+    std::ostringstream json;
+
+    json << "{\"symbols\":" << stats.symbols
+         << ",\"escapes\":" << stats.escapes
+         << ",\"rescales\":" << stats.rescales
+         << ",\"swaps\":" << stats.swaps
+         << ",\"code_bits\":" << stats.code_bits
+         << ",\"average_code_length\":" << average_code_length(stats)
+         << ",\"chunks\":" << stats.chunks
+         << ",\"duplicate_chunks\":" << stats.duplicate_chunks
+         << ",\"duplicate_bytes\":" << stats.duplicate_bytes
+         << ",\"dictionary_bytes\":" << stats.dictionary_bytes;
+
+    json << ",\"depth_histogram\":{";
+    bool first = true;
+    for (int depth = 0; depth < MAX_TREE_DEPTH; ++depth) {
+        if (stats.depth_histogram[depth] == 0)
+            continue;
+        json << (first ? "" : ",") << "\"" << depth << "\":" << stats.depth_histogram[depth];
+        first = false;
+    }
+    json << "}";
+
+    json << ",\"stage_seconds\":{";
+    first = true;
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        if (stats.stage_seconds[stage] == 0.0)
+            continue;
+        json << (first ? "" : ",") << "\"" << stage_names[stage] << "\":" << stats.stage_seconds[stage];
+        first = false;
+    }
+    json << "}}";
+
+    return json.str();
+}
+
+void start_next_segment(Tree *tree, BIT_FILE *input) {
+    /*
+     * Вызывается после END_OF_STREAM, если по заголовку
+     * (AHF_FLAG_SEGMENTED) за ним есть еще сегменты.
+     * Сегменты выровнены на границу байта, модель сбрасывается
+     * (статистика сохраняется) и декодирование продолжается.
+     * */
+
+    input->mask = 0x80;
+    int c = get_byte(input);
+    if (c == EOF)
+        throw std::runtime_error("Truncated archive: missing segment.\n");
+    input->unread = c;
+
+    auto stats = tree->stats;
+    initialize_tree(tree, tree->params);
+    tree->stats = stats;
+}
+
+std::string target_filename(const std::string &filename, const std::string &ext) {
+    /*
+     * Имя результирующего файла: исходный путь с замененным расширением.
+     * Пустое расширение - просто без расширения.
+     * */
+
+    std::filesystem::path path(filename);
+    auto stem = (path.parent_path() / path.stem()).string();
+    return ext.empty() ? stem : stem + "." + ext;
+}
+
+ArchiveHeader read_header(BIT_FILE *input) {
+    /*
+     * Чтение заголовка сжатого файла: исходное расширение,
+     * записанное по 8 бит на символ и завершенное нулем,
+     * с необязательным префиксом флагов
+     * */
+
+    ArchiveHeader header{};
+    unsigned char ch;
+
+    ch = input_bits(input, 8);
+    if (ch == AHF_HEADER_EXTENDED) {
+        header.flags = input_bits(input, 8);
+        if (header.flags & ~(AHF_FLAG_DEDUP | AHF_FLAG_MODEL | AHF_FLAG_SEGMENTED | AHF_FLAG_DICTIONARY))
+            throw std::runtime_error("Unsupported archive flags.\n");
+        if ((header.flags & AHF_FLAG_DICTIONARY) && !(header.flags & AHF_FLAG_DEDUP))
+            throw std::runtime_error("Corrupted header: dictionary without deduplication.\n");
+        if (header.flags & AHF_FLAG_MODEL) {
+            header.model.max_weight = input_bits(input, 32);
+            header.model.decay = input_bits(input, 8);
+            header.model.strategy = input_bits(input, 8);
+            if (header.model.max_weight < MIN_MODEL_WEIGHT || header.model.max_weight > MAX_MODEL_WEIGHT ||
+                header.model.decay < 16 || header.model.decay > 240 || header.model.strategy >= RESCALE_COUNT)
+                throw std::runtime_error("Unsupported model parameters.\n");
+            /*
+             * После масштабирования с округлением вверх вес корня может
+             * вырасти на число листьев. До следующего перестроения должно
+             * пройти еще не меньше SYMBOL_COUNT символов, иначе дерево
+             * перестраивалось бы почти на каждом символе
+             * */
+            if (header.model.max_weight * header.model.decay / 256 + 2 * SYMBOL_COUNT > header.model.max_weight)
+                throw std::runtime_error("Unsupported model parameters.\n");
+        }
+        if (header.flags & AHF_FLAG_SEGMENTED) {
+            header.segments = input_bits(input, 32);
+            if (header.segments == 0)
+                throw std::runtime_error("Corrupted header: no segments.\n");
+        }
+        if (header.flags & AHF_FLAG_DICTIONARY) {
+            while ((ch = input_bits(input, 8)) != '\0')
+                header.dictionary += ch;
+            if (header.dictionary.empty())
+                throw std::runtime_error("Corrupted header: empty dictionary name.\n");
+
+            /* Словарь ищется только внутри каталога архива: без корня, диска, UNC и .. */
+            std::filesystem::path dictionary(header.dictionary);
+            if (dictionary.has_root_name() || dictionary.has_root_directory() ||
+                std::any_of(dictionary.begin(), dictionary.end(), [](const auto &part) { return part == ".."; }))
+                throw std::runtime_error("Corrupted header: dictionary path leaves the archive directory.\n");
+            header.dictionary_size = input_bits(input, 32);
+            header.dictionary_checksum = input_bits(input, 32);
+        }
+        ch = input_bits(input, 8);
+    }
+
+    while (ch != '\0') {
+        header.extension += ch;
+        ch = input_bits(input, 8);
+    }
+
+    return header;
+}
+
+bool header_ready(const unsigned char *data, size_t size) {
+    /*
+     * TRUE, если data содержит заголовок целиком (или больше).
+     * Заголовок выровнен на байт, поля разбираются как в read_header,
+     * но без проверки значений - это сделает read_header.
+     * */
+
+    size_t at = 0;
+    auto skip_string = [&] {
+        while (at < size && data[at] != '\0')
+            ++at;
+        return at++ < size;
+    };
+
+    if (size == 0)
+        return false;
+    if (data[0] == AHF_HEADER_EXTENDED) {
+        if (size < 2)
+            return false;
+        unsigned flags = data[1];
+        at = 2;
+        if (flags & AHF_FLAG_MODEL)
+            at += 6;
+        if (flags & AHF_FLAG_SEGMENTED)
+            at += 4;
+        if ((flags & AHF_FLAG_DICTIONARY) && (!skip_string() || (at += 8) > size))
+            return false;
+    }
+    return skip_string();
+}
+
+void write_header(BIT_FILE *output, const ArchiveHeader &header) {
+    /*
+     * Параметры модели, число сегментов и словарь пишутся, только если
+     * отличаются от исходных, поэтому такие файлы читаются
+     * и прежними версиями
+     * */
+
+    auto flags = header.flags & ~(AHF_FLAG_MODEL | AHF_FLAG_SEGMENTED | AHF_FLAG_DICTIONARY);
+    if (header.model != DEFAULT_MODEL_PARAMS)
+        flags |= AHF_FLAG_MODEL;
+    if (header.segments > 1)
+        flags |= AHF_FLAG_SEGMENTED;
+    if (!header.dictionary.empty())
+        flags |= AHF_FLAG_DICTIONARY;
+
+    if (flags != 0) {
+        output_bits(output, AHF_HEADER_EXTENDED, 8);
+        output_bits(output, flags, 8);
+    }
+    if (flags & AHF_FLAG_MODEL) {
+        output_bits(output, header.model.max_weight, 32);
+        output_bits(output, header.model.decay, 8);
+        output_bits(output, header.model.strategy, 8);
+    }
+    if (flags & AHF_FLAG_SEGMENTED)
+        output_bits(output, header.segments, 32);
+    if (flags & AHF_FLAG_DICTIONARY) {
+        for (unsigned char c: header.dictionary)
+            output_bits(output, c, 8);
+        output_bits(output, 0, 8);
+        output_bits(output, header.dictionary_size, 32);
+        output_bits(output, header.dictionary_checksum, 32);
+    }
+    for (unsigned char c: header.extension)
+        output_bits(output, c, 8);
+    output_bits(output, 0, 8);
+}
+
+static const auto crc32_table = [] {
+    /*
+     * Таблица CRC-32 (полином 0xEDB88320)
+     * */
+
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        table[i] = crc;
+    }
+    return table;
+}();
+
+uint32_t crc32_update(uint32_t crc, unsigned char c) {
+    /*
+     * Добавление байта к CRC-32. Начальное значение 0,
+     * инверсия выполняется внутри, как в zlib.
+     * */
+
+    crc = ~crc;
+    crc = crc32_table[(crc ^ c) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+VerifyResult verify_archive(const std::string &filename) {
+    /*
+     * Проверка сжатого файла: полное декодирование в память
+     * без записи результата, подсчет размера и CRC-32 данных.
+     * */
+
+    TRACE_SCOPE("verify");
+
+    VerifyResult result{};
+    result.filename = filename;
+
+    BIT_FILE *input = open_input_bit_file(filename.c_str());
+    if (input == nullptr) {
+        result.error = "Error open source file.";
+        return result;
+    }
+
+    auto tree = std::make_unique<Tree>();
+    auto stage_start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> header_time{}, coding_time{};
+    try {
+        auto header = read_header(input);
+        result.extension = header.extension;
+
+        Decoder decoder;
+        initialize_decoder(&decoder, tree.get(), input, header, filename);
+        header_time = std::chrono::steady_clock::now() - stage_start;
+        stage_start = std::chrono::steady_clock::now();
+
+        uint32_t crc = 0;
+        int c;
+        while ((c = decode_next(&decoder)) != EOF)
+            crc = crc32_update(crc, c);
+        result.decoded_size = decoder.position;
+        coding_time = std::chrono::steady_clock::now() - stage_start;
+
+        if (get_byte(input) != EOF)
+            throw std::runtime_error("Trailing data after END_OF_STREAM.\n");
+
+        result.checksum = crc;
+        result.ok = true;
+    } catch (const std::runtime_error &e) {
+        result.error = e.what();
+        while (!result.error.empty() && result.error.back() == '\n')
+            result.error.pop_back();
+    }
+
+    result.compressed_size = input->byte_counter;
+    result.stats = tree->stats;
+    result.stats.stage_seconds[STAGE_HEADER] = header_time.count();
+    result.stats.stage_seconds[STAGE_CODING] = coding_time.count();
+    close_input_bit_file(input);
+
+    return result;
+}
+
+std::shared_ptr<const std::vector<unsigned char>> load_dictionary(const std::string &filename, uint_fast32_t size,
+                                                                  uint32_t checksum) {
+    /*
+     * Словарь пакета - обычный сжатый файл без ссылок в другой словарь,
+     * он распаковывается в память целиком и сверяется по размеру и CRC-32.
+     * Пока жив хотя бы один декодер со словарем, остальные получают
+     * ту же копию, так что архивы пакета, проверяемые параллельно,
+     * не распаковывают словарь каждый заново.
+     * */
+
+    static std::mutex mutex;
+    static std::map<std::pair<std::string, uint32_t>, std::weak_ptr<const std::vector<unsigned char>>> loaded;
+
+    auto key = std::make_pair(std::filesystem::absolute(filename).lexically_normal().string(), checksum);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto dictionary = loaded[key].lock())
+        return dictionary;
+
+    BIT_FILE *input = open_input_bit_file(filename.c_str());
+    if (input == nullptr)
+        throw std::runtime_error("Dictionary " + filename + " not found.\n");
+
+    auto data = std::make_shared<std::vector<unsigned char>>();
+    try {
+        auto header = read_header(input);
+        if (header.flags & AHF_FLAG_DICTIONARY)
+            throw std::runtime_error("Corrupted dictionary " + filename + ".\n");
+
+        auto tree = std::make_unique<Tree>();
+        Decoder decoder;
+        initialize_decoder(&decoder, tree.get(), input, header);
+        data->reserve(size);
+        uint32_t crc = 0;
+        int c;
+        while ((c = decode_next(&decoder)) != EOF && data->size() <= size) {
+            data->push_back((unsigned char) c);
+            crc = crc32_update(crc, c);
+        }
+        if (data->size() != size || crc != checksum)
+            throw std::runtime_error("Dictionary " + filename + " does not match the archive.\n");
+    } catch (const std::runtime_error &) {
+        close_input_bit_file(input);
+        throw;
+    }
+    close_input_bit_file(input);
+
+    loaded[key] = data;
+    return data;
+}
+
+std::vector<VerifyResult> verify_archives(const std::vector<std::string> &filenames, unsigned threads) {
+    /*
+     * Параллельная проверка нескольких сжатых файлов,
+     * по задаче на файл, threads == 0 означает число ядер.
+     * */
+
+    std::vector<VerifyResult> results(filenames.size());
+    parallel_for(filenames.size(), [&](size_t i) {
+        TRACE_BLOCK((int64_t) i);
+        results[i] = verify_archive(filenames[i]);
+    }, threads);
+
+    return results;
+}
+
+static const ModelParams MODEL_CANDIDATES[] = {
+        DEFAULT_MODEL_PARAMS,
+        {0x40000, 128, RESCALE_SCALE},
+        {0x4000, 128, RESCALE_SCALE},
+        {0x2000, 128, RESCALE_SCALE},
+        {0x2000, 128, RESCALE_PRUNE},
+        {0x4000, 160, RESCALE_PRUNE},
+        {0x8000, 96, RESCALE_PRUNE},
+        {0x1000, 64, RESCALE_PRUNE},
+};
+
+ModelParams level_params(int level) {
+    /*
+     * Параметры модели для уровня без анализа данных.
+     * Для LEVEL_BEST (нужна выборка) - исходные.
+     * */
+
+    switch (level) {
+        case LEVEL_FAST:
+            return {0x40000, 128, RESCALE_SCALE};
+        case LEVEL_ADAPTIVE:
+            return {0x2000, 128, RESCALE_PRUNE};
+        default:
+            return DEFAULT_MODEL_PARAMS;
+    }
+}
+
+static int discard_byte(int c, void *) {
+    return c;
+}
+
+static std::vector<std::vector<unsigned char>> read_slices(const std::string &filename,
+                                                           const std::vector<uint_fast64_t> &offsets,
+                                                           uint_fast64_t length) {
+    std::ifstream input(filename, std::ios::binary);
+    if (!input.is_open())
+        throw std::runtime_error("Error open source file.\n");
+
+    std::vector<std::vector<unsigned char>> slices;
+    for (auto offset: offsets) {
+        /* Смещения 64-битные: fseek с long на Windows ограничен 2 GiB */
+        std::vector<unsigned char> data(length);
+        input.clear();
+        if (!input.seekg((std::streamoff) offset))
+            throw std::runtime_error("Error on input.\n");
+        input.read((char *) data.data(), (std::streamsize) data.size());
+        if (input.bad())
+            throw std::runtime_error("Error on input.\n");
+        data.resize(input.gcount());
+        slices.push_back(std::move(data));
+    }
+
+    return slices;
+}
+
+ModelTrial prepare_model_trial(const std::string &filename) {
+    /*
+     * Файл до TRIAL_SAMPLE_SIZE пробуется целиком, поэтому выбор точный,
+     * иначе TRIAL_SLICE_COUNT участков по всему файлу кодируются подряд
+     * одной моделью, так что переходы между ними проверяют и скорость забывания
+     * */
+
+    std::error_code error;
+    auto size = std::filesystem::file_size(filename, error);
+    if (error)
+        throw std::runtime_error("Error open source file.\n");
+
+    ModelTrial trial;
+    trial.bits.resize(std::size(MODEL_CANDIDATES));
+    if (size == 0)
+        return trial;
+
+    std::vector<uint_fast64_t> offsets;
+    uint_fast64_t slice = size;
+    if (size <= TRIAL_SAMPLE_SIZE)
+        offsets.push_back(0);
+    else {
+        slice = TRIAL_SAMPLE_SIZE / TRIAL_SLICE_COUNT;
+        for (int i = 0; i < TRIAL_SLICE_COUNT; ++i)
+            offsets.push_back((size - slice) / (TRIAL_SLICE_COUNT - 1) * i);
+    }
+    trial.slices = read_slices(filename, offsets, slice);
+    return trial;
+}
+
+void run_model_trial(ModelTrial *trial, size_t candidate) {
+    /*
+     * Кодирование выборки в никуда вариантом candidate с подсчетом бит.
+     * Разные candidate пишут в разные элементы bits
+     * */
+
+    auto tree = std::make_unique<Tree>();
+    BIT_FILE *output = open_output_bit_stream(nullptr, discard_byte);
+    initialize_tree(tree.get(), MODEL_CANDIDATES[candidate]);
+    for (const auto &data: trial->slices)
+        for (auto c: data) {
+            encode_symbol(tree.get(), c, output);
+            update_model(tree.get(), c);
+        }
+    trial->bits[candidate] = tree->stats.code_bits;
+    close_output_bit_file(output);
+}
+
+ModelParams best_model_trial(const ModelTrial &trial) {
+    /*
+     * При равенстве выигрывает более ранний вариант,
+     * для пустого файла это DEFAULT_MODEL_PARAMS
+     * */
+
+    return MODEL_CANDIDATES[std::min_element(trial.bits.begin(), trial.bits.end()) - trial.bits.begin()];
+}
+
+ModelParams choose_model_params(const std::string &filename, int level) {
+    /*
+     * Для LEVEL_BEST каждый вариант из MODEL_CANDIDATES отдельной задачей
+     * кодирует в никуда одни и те же данные, считая биты.
+     * Пакетная обработка выполняет те же шаги задачами своего пула
+     * (см. Batch.cpp), чтобы не создавать пул внутри пула
+     * */
+
+    if (level != LEVEL_BEST)
+        return level_params(level);
+
+    TRACE_SCOPE("choose_model_params");
+
+    auto trial = prepare_model_trial(filename);
+    parallel_for(trial.bits.size(), [&](size_t i) {
+        TRACE_BLOCK((int64_t) i);
+        run_model_trial(&trial, i);
+    });
+    return best_model_trial(trial);
+}
+
+CompressionEstimate estimate_compression(const std::string &filename, int level, uint_fast64_t seed) {
+    /*
+     * Оценка размера и времени сжатия за миллисекунды.
+     * ESTIMATE_SLICE_COUNT участков в случайных местах файла
+     * (seed == 0 - от размера файла, чтобы оценка повторялась)
+     * кодируются в никуда, результат переносится на весь файл.
+     * Файл не больше выборки кодируется целиком.
+     * */
+
+    TRACE_SCOPE("estimate_compression");
+
+    CompressionEstimate estimate{};
+    std::error_code error;
+    estimate.source_size = std::filesystem::file_size(filename, error);
+    if (error)
+        throw std::runtime_error("Error open source file.\n");
+
+    auto header_size = std::filesystem::path(filename).extension().string().erase(0, 1).size() + 1;
+    auto model = level_params(level);
+    if (model != DEFAULT_MODEL_PARAMS)
+        header_size += 8;
+
+    std::vector<uint_fast64_t> offsets;
+    uint_fast64_t slice = ESTIMATE_SLICE_SIZE;
+    if (estimate.source_size <= (uint_fast64_t) ESTIMATE_SLICE_SIZE * ESTIMATE_SLICE_COUNT) {
+        offsets.push_back(0);
+        slice = estimate.source_size;
+    } else {
+        std::mt19937_64 random(seed != 0 ? seed : estimate.source_size);
+        std::uniform_int_distribution<uint_fast64_t> distribution(0, estimate.source_size - slice);
+        for (int i = 0; i < ESTIMATE_SLICE_COUNT; ++i)
+            offsets.push_back(distribution(random));
+        std::sort(offsets.begin(), offsets.end());
+    }
+    auto slices = read_slices(filename, offsets, slice);
+
+    auto tree = std::make_unique<Tree>();
+    BIT_FILE *output = open_output_bit_stream(nullptr, discard_byte);
+    uint_fast64_t bits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &data: slices) {
+        initialize_tree(tree.get(), model);
+        for (auto c: data) {
+            encode_symbol(tree.get(), c, output);
+            update_model(tree.get(), c);
+        }
+        encode_symbol(tree.get(), END_OF_STREAM, output);
+        bits += tree->stats.code_bits;
+        estimate.sampled_bytes += data.size();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    close_output_bit_file(output);
+
+    if (estimate.sampled_bytes == 0) {
+        estimate.predicted_size = header_size + 1;
+        return estimate;
+    }
+
+    auto scale = (double) estimate.source_size / (double) estimate.sampled_bytes;
+    estimate.predicted_size = header_size + (uint_fast64_t) std::ceil(bits * scale / 8);
+    estimate.ratio = estimate.predicted_size * 100.0 / estimate.source_size;
+    estimate.seconds = elapsed.count() * scale;
+
+    return estimate;
+}
+
+/*
+ * Основные функции адаптивного алгоритма Хаффмана
+ * */
+
+void initialize_tree(Tree *tree, const ModelParams &params) {
+    /*
+     * Функция инициализации дерева.
+     * Перед началом работы алгоритма дерево кодирования
+     * инициализируется двумя специальными (не ASCII) символами:
+     * ESCAPE и END_OF_STREAM.
+     * Также инициализируется корень дерева.
+     * Все листья инициализируются -1, так как они еще
+     * не присутствуют в дереве кодирования.
+     * */
+
+    tree->nodes[ROOT_NODE].child = ROOT_NODE + 1;
+    tree->nodes[ROOT_NODE].child_is_leaf = false;
+    tree->nodes[ROOT_NODE].weight = 2;
+    tree->nodes[ROOT_NODE].parent = -1;
+
+    tree->nodes[ROOT_NODE + 1].child = END_OF_STREAM;
+    tree->nodes[ROOT_NODE + 1].child_is_leaf = true;
+    tree->nodes[ROOT_NODE + 1].weight = 1;
+    tree->nodes[ROOT_NODE + 1].parent = ROOT_NODE;
+    tree->leaf[END_OF_STREAM] = ROOT_NODE + 1;
+
+    tree->nodes[ROOT_NODE + 2].child = ESCAPE;
+    tree->nodes[ROOT_NODE + 2].child_is_leaf = true;
+    tree->nodes[ROOT_NODE + 2].weight = 1;
+    tree->nodes[ROOT_NODE + 2].parent = ROOT_NODE;
+    tree->leaf[ESCAPE] = ROOT_NODE + 2;
+
+    tree->next_free_node = ROOT_NODE + 3;
+
+    for (int i = 0; i < END_OF_STREAM; ++i)
+        tree->leaf[i] = -1;
+
+    tree->params = params;
+    tree->stats = CodecStats{};
+}
+
+void encode_symbol(Tree *tree, unsigned int c, BIT_FILE *output) {
+    /*
+     * Преобразует входной символ в последовательность
+     * битов на основе текущего состояния дерева кодирования.
+     * Некоторое неудобство состоит в том, что, обходя дерево
+     * от листа к корню, мы получаем последовательность битов
+     * в обратном порядке, и поэтому необходимо аккумулировать биты
+     * в INTEGER переменной и выдавать их после того, как обход
+     * дерева закончен.
+     * */
+
+    TRACE_SCOPE_SAMPLED("encode_symbol");
+
+    unsigned long code = 0;
+    unsigned long current_bit = 1;
+    int code_size = 0;
+    int current_node = tree->leaf[c];
+
+    if (current_node == -1)
+        current_node = tree->leaf[ESCAPE];
+
+    while (current_node != ROOT_NODE) {
+        if ((current_node & 1) == 0)
+            code |= current_bit;
+        current_bit <<= 1;
+        ++code_size;
+        current_node = tree->nodes[current_node].parent;
+    }
+
+    output_bits(output, code, code_size);
+
+    ++tree->stats.symbols;
+    tree->stats.code_bits += code_size;
+    ++tree->stats.depth_histogram[std::min(code_size, MAX_TREE_DEPTH - 1)];
+
+    if (tree->leaf[c] == -1) {
+        output_bits(output, (unsigned long) c, 8);
+        add_new_node(tree, c);
+        ++tree->stats.escapes;
+        tree->stats.code_bits += 8;
+    }
+}
+
+int decode_symbol(Tree *tree, BIT_FILE *input) {
+    /*
+     * Процедура декодирования очень проста. Начиная от корня, мы
+     * обходим дерево, пока не дойдем до листа. Затем проверяем
+     * не прочитали ли мы ESCAPE код. Если да, то следующие 8 битов
+     * соответствуют незакодированному символу, который немедленно
+     * считывается и добавляется к таблице.
+     * */
+
+    TRACE_SCOPE_SAMPLED("decode_symbol");
+
+    int current_node;
+    int c;
+    int depth = 0;
+
+    current_node = ROOT_NODE;
+    while (!tree->nodes[current_node].child_is_leaf) {
+        current_node = tree->nodes[current_node].child;
+        current_node += input_bit(input);
+        ++depth;
+    }
+
+    ++tree->stats.symbols;
+    tree->stats.code_bits += depth;
+    ++tree->stats.depth_histogram[std::min(depth, MAX_TREE_DEPTH - 1)];
+
+    c = tree->nodes[current_node].child;
+    if (c == ESCAPE) {
+        c = (int) input_bits(input, 8);
+        if (tree->leaf[c] != (uint_fast32_t) -1 || tree->next_free_node + 2 > NODE_TABLE_COUNT)
+            throw std::runtime_error("Corrupted stream: unexpected ESCAPE.\n");
+        add_new_node(tree, c);
+        ++tree->stats.escapes;
+        tree->stats.code_bits += 8;
+    }
+    return (c);
+}
+
+void update_model(Tree *tree, int c) {
+    /*
+     * Процедура обновления модели кодирования для данного символа.
+     * */
+
+    TRACE_SCOPE_SAMPLED("update_model");
+
+    int current_node;
+    int new_node;
+
+    if (tree->nodes[ROOT_NODE].weight >= tree->params.max_weight)
+        rebuild_tree(tree);
+
+    current_node = tree->leaf[c];
+    while (current_node != -1) {
+        tree->nodes[current_node].weight++;
+
+        for (new_node = current_node; new_node > ROOT_NODE; new_node--)
+            if (tree->nodes[new_node - 1].weight >=
+                tree->nodes[current_node].weight)
+                break;
+
+        if (current_node != new_node) {
+            swap_nodes(tree, current_node, new_node);
+            current_node = new_node;
+        }
+
+        current_node = tree->nodes[current_node].parent;
+    }
+}
+
+void rebuild_tree(Tree *tree) {
+    /*
+     * Процедура перестроения дерева вызывается тогда, когда
+     * вес корня дерева достигает пороговой величины. Она
+     * начинается с умножения весов листьев на decay / 256
+     * (при исходных параметрах - деление на 2). Но из-за
+     * ошибок округления при этом может быть нарушено свойство
+     * упорядоченности дерева кодирования, и необходимы
+     * дополнительные усилия, чтобы привести его в корректное
+     * состояние.
+     * При стратегии RESCALE_PRUNE листья с нулевым весом удаляются,
+     * такой символ снова будет передан через ESCAPE.
+     * */
+
+    TRACE_SCOPE("rebuild_tree");
+
+    int i;
+    int j;
+    int k;
+    unsigned int weight;
+    Node leaves[SYMBOL_COUNT];
+    int leaf_count = 0;
+    bool prune = tree->params.strategy == RESCALE_PRUNE;
+
+    ++tree->stats.rescales;
+    for (i = tree->next_free_node - 1; i >= ROOT_NODE; i--) {
+        if (tree->nodes[i].child_is_leaf) {
+            weight = tree->nodes[i].weight * tree->params.decay;
+            weight = prune ? weight >> 8 : (weight + 255) >> 8;
+            if (prune && weight == 0) {
+                if (tree->nodes[i].child < END_OF_STREAM) {
+                    tree->leaf[tree->nodes[i].child] = -1;
+                    continue;
+                }
+                weight = 1;
+            }
+            leaves[leaf_count] = tree->nodes[i];
+            leaves[leaf_count++].weight = weight;
+        }
+    }
+
+    tree->next_free_node = leaf_count * 2 - 1;
+    j = tree->next_free_node - 1;
+    for (i = 0; i < leaf_count; i++, j--)
+        tree->nodes[j] = leaves[i];
+
+    for (i = tree->next_free_node - 2; j >= ROOT_NODE; i -= 2, j--) {
+        k = i + 1;
+        tree->nodes[j].weight =
+                tree->nodes[i].weight + tree->nodes[k].weight;
+        weight = tree->nodes[j].weight;
+        tree->nodes[j].child_is_leaf = 0;
+        for (k = j + 1; weight < tree->nodes[k].weight; k++);
+        k--;
+        memmove(&tree->nodes[j], &tree->nodes[j + 1],
+                (k - j) * sizeof(struct Node));
+        tree->nodes[k].weight = weight;
+        tree->nodes[k].child = i;
+        tree->nodes[k].child_is_leaf = 0;
+    }
+
+    for (i = tree->next_free_node - 1; i >= ROOT_NODE; i--) {
+        if (tree->nodes[i].child_is_leaf) {
+            k = tree->nodes[i].child;
+            tree->leaf[k] = i;
+        } else {
+            k = tree->nodes[i].child;
+            tree->nodes[k].parent =
+            tree->nodes[k + 1].parent = i;
+        }
+    }
+}
+
+void swap_nodes(Tree *tree, int i, int j) {
+    /*
+     * Процедура перестановки узлов дерева вызывается тогда, когда
+     * очередное увеличение веса узла привело к нарушению свойства
+     * упорядоченности.
+     * */
+
+    Node temp{};
+
+    ++tree->stats.swaps;
+    if (tree->nodes[i].child_is_leaf)
+        tree->leaf[tree->nodes[i].child] = j;
+    else {
+        tree->nodes[tree->nodes[i].child].parent = j;
+        tree->nodes[tree->nodes[i].child + 1].parent = j;
+    }
+    if (tree->nodes[j].child_is_leaf)
+        tree->leaf[tree->nodes[j].child] = i;
+    else {
+        tree->nodes[tree->nodes[j].child].parent = i;
+        tree->nodes[tree->nodes[j].child + 1].parent = i;
+    }
+    temp = tree->nodes[i];
+    tree->nodes[i] = tree->nodes[j];
+    tree->nodes[i].parent = temp.parent;
+    temp.parent = tree->nodes[j].parent;
+    tree->nodes[j] = temp;
+}
+
+void add_new_node(Tree *tree, int c) {
+    /*
+     * Для добавления самый легкий узел дерева разбивается на 2,
+     * один из которых и есть тот новый узел.
+     * Новому узлу присваивается вес 0, который будет изменен потом,
+     * при нормальном процессе обновления дерева.
+     * */
+
+    uint_fast32_t lightest_node = tree->next_free_node - 1;
+    uint_fast32_t new_node = tree->next_free_node;
+    uint_fast32_t zero_weight_node = tree->next_free_node + 1;
+    tree->next_free_node += 2;
+
+    tree->nodes[new_node] = tree->nodes[lightest_node];
+    tree->nodes[new_node].parent = lightest_node;
+    tree->leaf[tree->nodes[new_node].child] = new_node;
+
+    tree->nodes[lightest_node].child = new_node;
+    tree->nodes[lightest_node].child_is_leaf = false;
+
+    tree->nodes[zero_weight_node].child = c;
+    tree->nodes[zero_weight_node].child_is_leaf = true;
+    tree->nodes[zero_weight_node].weight = 0;
+    tree->nodes[zero_weight_node].parent = lightest_node;
+    tree->leaf[c] = zero_weight_node;
+}
+
+void initialize_decoder(Decoder *decoder, Tree *tree, BIT_FILE *input, const ArchiveHeader &header,
+                        const std::string &archive_filename) {
+    /*
+     * С AHF_FLAG_DICTIONARY словарь ищется относительно каталога
+     * archive_filename, поэтому для потока без имени файла
+     * такой архив не читается
+     * */
+
+    decoder->tree = tree;
+    decoder->input = input;
+    decoder->flags = header.flags;
+    decoder->position = 0;
+    decoder->literal_left = 0;
+    decoder->copy_left = 0;
+    decoder->copy_distance = 0;
+    decoder->dictionary_left = 0;
+    decoder->dictionary_offset = 0;
+    decoder->segments_left = header.segments - 1;
+    decoder->finished = false;
+    decoder->history.clear();
+    decoder->dictionary.reset();
+    initialize_tree(tree, header.model);
+
+    if (header.flags & AHF_FLAG_DICTIONARY) {
+        if (archive_filename.empty())
+            throw std::runtime_error("Archive needs dictionary " + header.dictionary + ", but its location is unknown.\n");
+        auto path = std::filesystem::path(archive_filename).parent_path() / header.dictionary;
+        decoder->dictionary = load_dictionary(path.string(), header.dictionary_size, header.dictionary_checksum);
+    }
+}
+
+static inline void remember(Decoder *decoder, int c) {
+    /*
+     * Сохранение байта в окне для разрешения ссылок
+     * */
+
+    auto at = decoder->position & (DEDUP_WINDOW - 1);
+    if (at == decoder->history.size())
+        decoder->history.push_back((unsigned char) c);
+    else
+        decoder->history[at] = (unsigned char) c;
+    ++decoder->position;
+}
+
+static bool end_of_segment(Decoder *decoder) {
+    /*
+     * После END_OF_STREAM: TRUE, если сегмент был последним.
+     * За последним сегментом ничего не читается, поэтому
+     * поток после архива остается нетронутым.
+     * */
+
+    if (decoder->segments_left == 0) {
+        decoder->finished = true;
+        return true;
+    }
+    --decoder->segments_left;
+    start_next_segment(decoder->tree, decoder->input);
+    return false;
+}
+
+struct BitPeek {
+    /*
+     * Чтение битов вперед без изменения BIT_FILE: сначала
+     * его текущий байт и возвращенный байт, затем data
+     * */
+
+    const unsigned char *data;
+    size_t size;
+    size_t next;
+    int unread;
+    int rack;
+    unsigned char mask;
+};
+
+static bool peek_bits(BitPeek &peek, int bit_count, uint_fast64_t *value) {
+    *value = 0;
+    for (int i = 0; i < bit_count; ++i) {
+        if (peek.mask == 0x80) {
+            if (peek.unread != EOF) {
+                peek.rack = peek.unread;
+                peek.unread = EOF;
+            } else if (peek.next < peek.size)
+                peek.rack = peek.data[peek.next++];
+            else
+                return false;
+        }
+        *value = (*value << 1) | ((peek.rack & peek.mask) ? 1 : 0);
+        peek.mask >>= 1;
+        if (peek.mask == 0)
+            peek.mask = 0x80;
+    }
+    return true;
+}
+
+static bool peek_symbol(BitPeek &peek, const Tree *tree, int *symbol) {
+    /*
+     * Тот же обход, что в decode_symbol, без обновления модели
+     * */
+
+    uint_fast64_t bit;
+    int node = ROOT_NODE;
+    while (!tree->nodes[node].child_is_leaf) {
+        if (!peek_bits(peek, 1, &bit))
+            return false;
+        node = (int) tree->nodes[node].child + (int) bit;
+    }
+    *symbol = (int) tree->nodes[node].child;
+    return *symbol != ESCAPE || peek_bits(peek, 8, &bit);
+}
+
+bool decoder_ready(const Decoder *decoder, const unsigned char *data, size_t size) {
+    /*
+     * TRUE, если следующему decode_next хватит уже прочитанных
+     * из input байт и data[0..size). Повторяет разбор записей
+     * decode_next, но только читает биты и дерево. Нужна для потока,
+     * данные которого приходят частями: декодер нельзя остановить
+     * посреди символа, поэтому он вызывается, только когда хватит данных.
+     * Ошибки формата здесь не ищутся - их найдет decode_next.
+     * */
+
+    if (decoder->finished || decoder->copy_left != 0 || decoder->dictionary_left != 0)
+        return true;
+
+    static const auto fresh_tree = [] {
+        auto tree = std::make_unique<Tree>();
+        initialize_tree(tree.get());
+        return tree;
+    }();
+
+    BitPeek peek{data, size, 0, decoder->input->unread, decoder->input->rack, decoder->input->mask};
+    const Tree *tree = decoder->tree;
+    auto segments_left = decoder->segments_left;
+    bool dedup = decoder->flags & AHF_FLAG_DEDUP;
+    bool literal = decoder->literal_left != 0;
+    uint_fast64_t bit, value;
+    int symbol;
+
+    while (true) {
+        if (!dedup || literal) {
+            if (!peek_symbol(peek, tree, &symbol))
+                return false;
+            if (symbol != END_OF_STREAM || dedup || segments_left == 0)
+                return true;
+        } else {
+            if (!peek_bits(peek, 1, &bit) || !peek_bits(peek, 32, &value))
+                return false;
+            if (bit == 0) {
+                literal = value != 0;
+                continue;
+            }
+            if (value != 0)
+                return peek_bits(peek, value == DEDUP_DICTIONARY_REFERENCE ? 64 : 32, &value);
+            if (!peek_symbol(peek, tree, &symbol))
+                return false;
+            if (symbol != END_OF_STREAM || segments_left == 0)
+                return true;
+        }
+
+        /* Следующий сегмент: с границы байта и со свежей моделью */
+        --segments_left;
+        peek.mask = 0x80;
+        tree = fresh_tree.get();
+    }
+}
+
+int decode_next(Decoder *decoder) {
+    /*
+     * Очередной байт исходных данных или EOF после последнего сегмента.
+     * Без AHF_FLAG_DEDUP это просто decode_symbol и update_model.
+     * */
+
+    Tree *tree = decoder->tree;
+    BIT_FILE *input = decoder->input;
+    int c;
+
+    if (decoder->finished)
+        return EOF;
+
+    if (!(decoder->flags & AHF_FLAG_DEDUP)) {
+        while ((c = decode_symbol(tree, input)) == END_OF_STREAM) {
+            if (end_of_segment(decoder))
+                return EOF;
+        }
+        update_model(tree, c);
+        ++decoder->position;
+        return c;
+    }
+
+    while (true) {
+        if (decoder->dictionary_left != 0) {
+            --decoder->dictionary_left;
+            c = (*decoder->dictionary)[decoder->dictionary_offset++];
+            remember(decoder, c);
+            return c;
+        }
+
+        if (decoder->copy_left != 0) {
+            --decoder->copy_left;
+            c = decoder->history[(decoder->position - decoder->copy_distance) & (DEDUP_WINDOW - 1)];
+            remember(decoder, c);
+            return c;
+        }
+
+        if (decoder->literal_left != 0) {
+            if ((c = decode_symbol(tree, input)) == END_OF_STREAM)
+                throw std::runtime_error("Corrupted stream: END_OF_STREAM inside chunk.\n");
+            update_model(tree, c);
+            --decoder->literal_left;
+            remember(decoder, c);
+            return c;
+        }
+
+        if (input_bit(input) == 0) {
+            decoder->literal_left = input_bits(input, 32);
+            continue;
+        }
+
+        auto distance = input_bits(input, 32);
+        if (distance == 0) {
+            if (decode_symbol(tree, input) != END_OF_STREAM)
+                throw std::runtime_error("Corrupted stream: missing END_OF_STREAM.\n");
+            if (end_of_segment(decoder))
+                return EOF;
+            continue;
+        }
+
+        if (distance == DEDUP_DICTIONARY_REFERENCE) {
+            uint_fast64_t offset = input_bits(input, 32);
+            uint_fast64_t length = input_bits(input, 32);
+            if (!decoder->dictionary || offset + length > decoder->dictionary->size())
+                throw std::runtime_error("Corrupted stream: reference out of dictionary.\n");
+            decoder->dictionary_offset = offset;
+            decoder->dictionary_left = length;
+            tree->stats.duplicate_bytes += length;
+            tree->stats.dictionary_bytes += length;
+            continue;
+        }
+
+        auto length = input_bits(input, 32);
+        if (distance > decoder->position || distance > DEDUP_WINDOW)
+            throw std::runtime_error("Corrupted stream: reference out of window.\n");
+        decoder->copy_distance = distance;
+        decoder->copy_left = length;
+        tree->stats.duplicate_bytes += length;
+    }
+}
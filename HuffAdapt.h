@@ -0,0 +1,335 @@
+#pragma once
+
+#ifndef ZFCD_HUFFADAPT_H
+#define ZFCD_HUFFADAPT_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <array>
+#include <vector>
+#include <memory>
+
+const uint_fast32_t END_OF_STREAM = 256; /* Маркер конца потока */
+const uint_fast32_t ESCAPE = 257;        /* Маркер начала ESCAPE последовательности */
+const uint_fast32_t SYMBOL_COUNT = 258;  /* Максимально возможное количество листьев дерева (256+2 маркера) */
+
+#define NODE_TABLE_COUNT ((SYMBOL_COUNT * 2) - 1)
+#define ROOT_NODE 0
+const uint_fast32_t MAX_WEIGHT = 0x8000; /* Вес корня, при котором начинается масштабирование веса */
+const uint_fast32_t MIN_MODEL_WEIGHT = 0x400;   /* Допустимые пороги масштабирования в заголовке */
+const uint_fast32_t MAX_MODEL_WEIGHT = 0x40000; /* (выше глубина дерева может превысить 32 бита кода) */
+
+#define MAX_TREE_DEPTH 32 // Размер гистограммы глубин, более глубокие листья учитываются в последней ячейке
+
+#define AHF_HEADER_EXTENDED 0x01 // Первый байт расширенного заголовка (в расширении файла не встречается)
+#define AHF_FLAG_DEDUP 0x01      // Поток состоит из записей дедупликации (см. Dedup.h)
+#define AHF_FLAG_MODEL 0x02      // За флагами записаны параметры модели (ModelParams)
+#define AHF_FLAG_SEGMENTED 0x04  // Файл состоит из нескольких сегментов, их число записано в заголовке
+#define AHF_FLAG_DICTIONARY 0x08 // Ссылки дедупликации могут указывать в общий словарь пакета (отдельный .ahf)
+#define DEDUP_WINDOW 0x4000000   // 64 MiB, максимальное расстояние ссылки дедупликации
+#define DEDUP_DICTIONARY_REFERENCE 0xFFFFFFFF // Расстояние, которым отмечается ссылка в словарь
+#define DEDUP_DICTIONARY_LIMIT 0x10000000     // 256 MiB, наибольший размер словаря
+
+struct BIT_FILE {
+    /*
+     * Структура побитового доступа к файлу.
+     * Если file == NULL, байты читаются и пишутся
+     * через функции read_byte/write_byte пользовательского потока.
+     * */
+
+    FILE *file;
+    unsigned char mask;
+    int rack;
+    uint_fast64_t byte_counter; /* Количество записанных/прочитанных байт */
+    int unread;                 /* Возвращенный во ввод байт или EOF */
+    void *stream;
+    int (*read_byte)(void *stream);
+    int (*write_byte)(int c, void *stream);
+};
+
+enum RESCALE_STRATEGIES {
+    RESCALE_SCALE, /* Веса умножаются на decay с округлением вверх, символы остаются в дереве */
+    RESCALE_PRUNE, /* Веса умножаются на decay с округлением вниз, обнулившиеся символы удаляются */
+    RESCALE_COUNT
+};
+
+struct ModelParams {
+    /*
+     * Параметры старения модели.
+     * Когда вес корня достигает max_weight, веса листьев умножаются
+     * на decay / 256 и дерево перестраивается (rebuild_tree).
+     * Меньший порог и меньший decay - быстрее забывается старая
+     * статистика, больший - точнее оценки на однородных данных.
+     * */
+
+    uint_fast32_t max_weight;
+    unsigned decay;    /* Множитель весов в 1/256, от 16 до 240 */
+    unsigned strategy; /* RESCALE_STRATEGIES */
+
+    bool operator==(const ModelParams &) const = default;
+};
+
+const ModelParams DEFAULT_MODEL_PARAMS = {MAX_WEIGHT, 128, RESCALE_SCALE}; /* Исходное поведение: деление весов на 2 */
+
+/*
+ * Уровни сжатия. Замеры на 8 MB (текст / исполняемый файл / чередование
+ * текста и кода по 2 MB), время относительно LEVEL_NORMAL:
+ *   LEVEL_FAST     - порог 0x40000, decay 1/2: редкие перестроения, ~8% быстрее,
+ *                    на тексте так же, на коде и смешанных данных до 3% хуже.
+ *   LEVEL_NORMAL   - порог 0x8000, decay 1/2: исходный формат (без параметров в заголовке).
+ *   LEVEL_ADAPTIVE - порог 0x2000, decay 1/2, удаление редких символов:
+ *                    на 15-45% медленнее, на коде и смешанных данных до 0.4% лучше.
+ *   LEVEL_BEST     - пробное кодирование всеми MODEL_CANDIDATES параллельно,
+ *                    выбирается наименьший результат. Файл до TRIAL_SAMPLE_SIZE
+ *                    пробуется целиком и сжимается не хуже остальных уровней,
+ *                    для большего файла выбор делается по выборке, и результат
+ *                    может быть на доли процента хуже лучшего из фиксированных.
+ *                    Кодирование как у выбранного варианта плюс время пробы: при ядре
+ *                    на каждый вариант - как одно кодирование TRIAL_SAMPLE_SIZE.
+ * */
+
+enum COMPRESSION_LEVELS {
+    LEVEL_FAST = 1, LEVEL_NORMAL, LEVEL_ADAPTIVE, LEVEL_BEST
+};
+
+#define DEFAULT_COMPRESSION_LEVEL LEVEL_NORMAL
+#define TRIAL_SAMPLE_SIZE 0x800000 // 8 MiB, для большего файла набирается из TRIAL_SLICE_COUNT участков
+#define TRIAL_SLICE_COUNT 16
+#define ESTIMATE_SLICE_SIZE 0x10000 // 64 KiB, участок выборки для оценки сжатия
+#define ESTIMATE_SLICE_COUNT 8
+
+enum CODEC_STAGES {
+    STAGE_HEADER, STAGE_DEDUP, STAGE_CODING, STAGE_FINALIZE, STAGE_COUNT
+};
+
+struct CodecStats {
+    /*
+     * Статистика работы кодека.
+     * Заполняется по ходу кодирования/декодирования
+     * простыми инкрементами, без обращения к часам на каждый символ.
+     * */
+
+    uint_fast64_t symbols;   /* Количество обработанных символов (включая END_OF_STREAM) */
+    uint_fast64_t escapes;   /* Количество ESCAPE последовательностей (первое появление символа) */
+    uint_fast64_t rescales;  /* Количество масштабирований дерева (rebuild_tree) */
+    uint_fast64_t swaps;     /* Количество перестановок узлов (swap_nodes) */
+    uint_fast64_t code_bits; /* Суммарная длина кодов в битах, включая 8-битные литералы после ESCAPE */
+    uint_fast64_t chunks;           /* Фрагментов дедупликации */
+    uint_fast64_t duplicate_chunks; /* Из них замененных ссылкой */
+    uint_fast64_t duplicate_bytes;  /* Байт, не прошедших через модель */
+    uint_fast64_t dictionary_bytes; /* Из них взятых из общего словаря */
+    std::array<uint_fast64_t, MAX_TREE_DEPTH> depth_histogram; /* Гистограмма глубин закодированных листьев */
+    std::array<double, STAGE_COUNT> stage_seconds;             /* Время по этапам, в секундах (0 - не замерялось) */
+};
+
+struct ArchiveHeader {
+    /*
+     * Заголовок сжатого файла.
+     * Без флагов пишется в исходном виде: расширение и завершающий ноль.
+     * С флагами поля идут в порядке:
+     *   AHF_HEADER_EXTENDED (8 бит), флаги (8 бит);
+     *   с AHF_FLAG_MODEL - порог (32 бита), decay и стратегия (по 8 бит);
+     *   с AHF_FLAG_SEGMENTED - число сегментов (32 бита);
+     *   с AHF_FLAG_DICTIONARY - путь к словарю внутри каталога архива
+     *   (без корня и ..) и ноль, размер словаря и его CRC-32 (по 32 бита);
+     *   расширение, ноль.
+     * За заголовком идут сегменты: каждый закодирован со свежей моделью,
+     * заканчивается END_OF_STREAM и дополнен до границы байта.
+     * Без AHF_FLAG_SEGMENTED сегмент один, и данные после него - ошибка.
+     * */
+
+    std::string extension;
+    unsigned flags;
+    ModelParams model = DEFAULT_MODEL_PARAMS; /* Отличные от исходных пишутся с AHF_FLAG_MODEL */
+    uint_fast32_t segments = 1;               /* Больше одного пишется с AHF_FLAG_SEGMENTED */
+    std::string dictionary{};                 /* Непустой пишется с AHF_FLAG_DICTIONARY */
+    uint_fast32_t dictionary_size = 0;
+    uint32_t dictionary_checksum = 0;
+};
+
+struct VerifyResult {
+    /*
+     * Результат проверки сжатого файла
+     * */
+
+    std::string filename;          /* Проверенный файл */
+    bool ok;                       /* TRUE, если поток декодирован до END_OF_STREAM */
+    std::string error;             /* Причина ошибки, если ok == FALSE */
+    std::string extension;         /* Расширение исходного файла из заголовка */
+    uint_fast64_t compressed_size; /* Прочитано байт сжатого файла */
+    uint_fast64_t decoded_size;    /* Размер декодированных данных */
+    uint32_t checksum;             /* CRC-32 декодированных данных */
+    CodecStats stats;
+};
+
+struct CompressionEstimate {
+    /*
+     * Прогноз сжатия по случайной выборке, без полного прохода.
+     * Каждый участок кодируется со свежей моделью, поэтому на
+     * больших файлах размер обычно немного завышен. Дедупликация
+     * и время пробы LEVEL_BEST не учитываются.
+     * */
+
+    uint_fast64_t source_size;    /* Размер исходного файла */
+    uint_fast64_t sampled_bytes;  /* Закодировано байт выборки */
+    uint_fast64_t predicted_size; /* Ожидаемый размер .ahf */
+    double ratio;                 /* predicted_size / source_size, в процентах */
+    double seconds;               /* Ожидаемое время кодирования в одном потоке */
+};
+
+struct ModelTrial {
+    /*
+     * Пробное кодирование LEVEL_BEST по шагам: выборка читается
+     * в prepare_model_trial, каждый вариант MODEL_CANDIDATES
+     * кодируется отдельным вызовом run_model_trial (их можно
+     * выполнять параллельно), итог выбирает best_model_trial
+     * */
+
+    std::vector<std::vector<unsigned char>> slices; /* Участки исходного файла */
+    std::vector<uint_fast64_t> bits;                /* Размер кода для каждого варианта */
+};
+
+struct Node {
+    /*
+     * Узел дерева
+     * */
+
+    uint_fast32_t weight; /* Вес символа */
+    uint_fast32_t parent; /* Номер родителя в массиве узлов */
+    bool child_is_leaf;   /* Флаг листа (TRUE, если лист) */
+    uint_fast32_t child;
+};
+
+struct Tree {
+    /*
+     * Структура дерева
+     * */
+
+    uint_fast32_t leaf[SYMBOL_COUNT]; /* Массив листьев дерева */
+    uint_fast32_t next_free_node; /* Номер следующего свободного элемента массива листьев */
+    std::array<Node, NODE_TABLE_COUNT> nodes; /* Массив узлов */
+    ModelParams params; /* Параметры старения модели */
+    CodecStats stats; /* Статистика, сбрасывается в initialize_tree */
+};
+
+struct Decoder {
+    /*
+     * Состояние чтения потока .ahf: сегменты и записи дедупликации
+     * */
+
+    Tree *tree;
+    BIT_FILE *input;
+    unsigned flags;
+    uint_fast64_t position;      /* Выдано байт */
+    uint_fast64_t literal_left;  /* Осталось символов текущего литерала */
+    uint_fast64_t copy_left;     /* Осталось байт текущей ссылки */
+    uint_fast64_t copy_distance;
+    uint_fast64_t dictionary_left; /* Осталось байт текущей ссылки в словарь */
+    uint_fast64_t dictionary_offset;
+    uint_fast64_t segments_left; /* Сегментов после текущего */
+    bool finished;               /* Последний END_OF_STREAM прочитан */
+    std::vector<unsigned char> history; /* Последние DEDUP_WINDOW байт, только с AHF_FLAG_DEDUP */
+    std::shared_ptr<const std::vector<unsigned char>> dictionary; /* Только с AHF_FLAG_DICTIONARY */
+};
+
+/*
+ * Побитовый файловый доступ
+ * */
+
+BIT_FILE *open_input_bit_file(const char *name);
+
+BIT_FILE *open_output_bit_file(const char *name);
+
+BIT_FILE *open_input_bit_stream(void *stream, int (*read_byte)(void *stream));
+
+BIT_FILE *open_output_bit_stream(void *stream, int (*write_byte)(int c, void *stream));
+
+void output_bit(BIT_FILE *compressed_file, int bit);
+
+void output_bits(BIT_FILE *compressed_file, unsigned long code, int bit_count);
+
+int input_bit(BIT_FILE *compressed_file);
+
+unsigned long input_bits(BIT_FILE *compressed_file, int bit_count);
+
+void close_input_bit_file(BIT_FILE *compressed_file);
+
+void close_output_bit_file(BIT_FILE *compressed_file);
+
+/*
+ * Сервисные функции
+ * */
+
+uint_fast32_t file_size(const char *name);
+
+void print_results(char *input, char *output);
+
+void print_fatal_error(char *fmt);
+
+void help();
+
+double average_code_length(const CodecStats &stats);
+
+std::string codec_stats_to_json(const CodecStats &stats);
+
+ArchiveHeader read_header(BIT_FILE *input);
+
+bool header_ready(const unsigned char *data, size_t size);
+
+void write_header(BIT_FILE *output, const ArchiveHeader &header);
+
+void start_next_segment(Tree *tree, BIT_FILE *input);
+
+std::string target_filename(const std::string &filename, const std::string &ext);
+
+uint32_t crc32_update(uint32_t crc, unsigned char c);
+
+VerifyResult verify_archive(const std::string &filename);
+
+std::shared_ptr<const std::vector<unsigned char>> load_dictionary(const std::string &filename, uint_fast32_t size,
+                                                                  uint32_t checksum);
+
+std::vector<VerifyResult> verify_archives(const std::vector<std::string> &filenames, unsigned threads = 0);
+
+ModelParams level_params(int level);
+
+ModelParams choose_model_params(const std::string &filename, int level);
+
+ModelTrial prepare_model_trial(const std::string &filename);
+
+void run_model_trial(ModelTrial *trial, size_t candidate);
+
+ModelParams best_model_trial(const ModelTrial &trial);
+
+CompressionEstimate estimate_compression(const std::string &filename, int level = DEFAULT_COMPRESSION_LEVEL,
+                                         uint_fast64_t seed = 0);
+
+/*
+ * Основные функции адаптивного алгоритма Хаффмана
+ * */
+
+void initialize_tree(Tree *tree, const ModelParams &params = DEFAULT_MODEL_PARAMS);
+
+void encode_symbol(Tree *tree, unsigned int c, BIT_FILE *output);
+
+int decode_symbol(Tree *tree, BIT_FILE *input);
+
+void update_model(Tree *tree, int c);
+
+void rebuild_tree(Tree *tree);
+
+void swap_nodes(Tree *tree, int i, int j);
+
+void add_new_node(Tree *tree, int c);
+
+void initialize_decoder(Decoder *decoder, Tree *tree, BIT_FILE *input, const ArchiveHeader &header,
+                        const std::string &archive_filename = {});
+
+int decode_next(Decoder *decoder);
+
+bool decoder_ready(const Decoder *decoder, const unsigned char *data, size_t size);
+
+#endif //ZFCD_HUFFADAPT_H
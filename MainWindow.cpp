@@ -1,584 +1,149 @@
 #include "MainWindow.h"
+#include "Trace.h"
 
-const uint_fast32_t END_OF_STREAM = 256; /* Маркер конца потока */
-const uint_fast32_t ESCAPE = 257;        /* Маркер начала ESCAPE последовательности */
-const uint_fast32_t SYMBOL_COUNT = 258;  /* Максимально возможное количество листьев дерева (256+2 маркера) */
+#define TRACE_BLOCK_SHIFT 16 // События трассировки помечаются номером блока входных данных по 64 KiB
+#define SEARCH_REPORT_LIMIT 10 // Совпадений на файл в отчете поиска
 
-#define NODE_TABLE_COUNT ((SYMBOL_COUNT * 2) - 1)
-#define ROOT_NODE 0
-const uint_fast32_t MAX_WEIGHT = 0x8000; /* Вес корня, при котором начинается масштабирование веса */
-
-#define PACIFIER_COUNT 2047 // Шаг индикатора выполнения для периодического консольного вывода
-
-struct Node {
-    /*
-     * Узел дерева
-     * */
-
-    uint_fast32_t weight; /* Вес символа */
-    uint_fast32_t parent; /* Номер родителя в массиве узлов */
-    bool child_is_leaf;   /* Флаг листа (TRUE, если лист) */
-    uint_fast32_t child;
-};
-
-struct Tree {
-    /*
-     * Структура дерева
-     * */
-
-    uint_fast32_t leaf[SYMBOL_COUNT]; /* Массив листьев дерева */
-    uint_fast32_t next_free_node; /* Номер следующего свободного элемента массива листьев */
-    std::array<Node, NODE_TABLE_COUNT> nodes; /* Массив узлов */
-};
-
-/*
- * Побитовый файловый доступ
- * */
-
-BIT_FILE *open_input_bit_file(const char *name) {
-    /*
-     * Открытие файла для побитового ввода
-     * */
-    BIT_FILE *compressed_file;
-
-    compressed_file = (BIT_FILE *)
-            calloc(1, sizeof(BIT_FILE));
-    if (compressed_file == NULL)
-        return (compressed_file);
-    compressed_file->file = fopen(name, "rb");
-    compressed_file->rack = 0;
-    compressed_file->mask = 0x80;
-    compressed_file->pacifier_counter = 0;
-    return (compressed_file);
-}
-
-BIT_FILE *open_output_bit_file(const char *name) {
-    /*
-     * Открытие файла для побитового вывода
-     * */
-    BIT_FILE *compressed_file;
-
-    compressed_file = (BIT_FILE *)
-            calloc(1, sizeof(BIT_FILE));
-    if (compressed_file == NULL)
-        return (compressed_file);
-    compressed_file->file = fopen(name, "wb");
-    compressed_file->rack = 0;
-    compressed_file->mask = 0x80;
-    compressed_file->pacifier_counter = 0;
-    return (compressed_file);
-}
-
-void output_bit(BIT_FILE *compressed_file, int bit) {
-    /*
-     * Вывод одного бита в файл
-     * */
-
-    if (bit)
-        compressed_file->rack |= compressed_file->mask;
-    compressed_file->mask >>= 1;
-    if (compressed_file->mask == 0) {
-        if (putc(compressed_file->rack, compressed_file->file) !=
-            compressed_file->rack)
-            throw std::runtime_error("Error on output_bit!\n");
-        else if ((compressed_file->pacifier_counter++ &
-                  PACIFIER_COUNT) == 0)
-            putc('.', stdout);
-        compressed_file->rack = 0;
-        compressed_file->mask = 0x80;
-    }
-}
-
-void output_bits(BIT_FILE *compressed_file, unsigned long code, int bit_count) {
-    /*
-     * Вывод bit_count бит в файл
-     * */
-
-    unsigned long mask;
-
-    mask = 1L << (bit_count - 1);
-    while (mask != 0) {
-        if (mask & code)
-            compressed_file->rack |= compressed_file->mask;
-        compressed_file->mask >>= 1;
-        if (compressed_file->mask == 0) {
-            if (putc(compressed_file->rack, compressed_file->file) !=
-                compressed_file->rack)
-                throw std::runtime_error("Error on output_bits!\n");
-
-            else if ((compressed_file->pacifier_counter++ &
-                      PACIFIER_COUNT) == 0)
-                putc('.', stdout);
-            compressed_file->rack = 0;
-            compressed_file->mask = 0x80;
-        }
-        mask >>= 1;
-    }
-}
-
-int input_bit(BIT_FILE *compressed_file) {
-    /*
-     * Ввод одного бита в файл
-     * */
-    int value;
-
-    if (compressed_file->mask == 0x80) {
-        compressed_file->rack = getc(compressed_file->file);
-        if (compressed_file->rack == EOF)
-            throw std::runtime_error("Error on input_bit!\n");
-
-        if ((compressed_file->pacifier_counter++ &
-             PACIFIER_COUNT) == 0)
-            putc('.', stdout);
-    }
-    value = compressed_file->rack & compressed_file->mask;
-    compressed_file->mask >>= 1;
-    if (compressed_file->mask == 0)
-        compressed_file->mask = 0x80;
-    return (value ? 1 : 0);
-}
-
-unsigned long input_bits(BIT_FILE *compressed_file, int bit_count) {
-    /*
-     * Ввод bit_count бит в файл
-     * */
-    uint_fast32_t mask;
-    uint_fast32_t return_value;
-
-    mask = 1L << (bit_count - 1);
-    return_value = 0;
-    while (mask != 0) {
-        if (compressed_file->mask == 0x80) {
-            compressed_file->rack = getc(compressed_file->file);
-            if (compressed_file->rack == EOF)
-                throw std::runtime_error("Error on input_bits!\n");
-
-            if ((compressed_file->pacifier_counter++ &
-                 PACIFIER_COUNT) == 0)
-                putc('.', stdout);
-        }
-        if (compressed_file->rack & compressed_file->mask)
-            return_value |= mask;
-        mask >>= 1;
-        compressed_file->mask >>= 1;
-        if (compressed_file->mask == 0)
-            compressed_file->mask = 0x80;
-    }
-
-    return return_value;
-}
-
-void close_input_bit_file(BIT_FILE *compressed_file) {
-    /*
-     * Закрытие файла, открытого для побитового ввода
-     * */
-
-    fclose(compressed_file->file);
-    free((char *) compressed_file);
-}
+Tree model_tree; // Модель кодирования
 
-void close_output_bit_file(BIT_FILE *compressed_file) {
+static double seconds_since(std::chrono::time_point<std::chrono::high_resolution_clock> &stage_start) {
     /*
-     * Закрытие файла, открытого для побитового вывода
+     * Возвращает время в секундах с начала этапа и начинает отсчет следующего
      * */
 
-    if (compressed_file->mask != 0x80)
-        if (putc(compressed_file->rack, compressed_file->file) !=
-            compressed_file->rack)
-            throw std::runtime_error("Error on close compressed file.\n");
-    fflush(compressed_file->file);
-    fclose(compressed_file->file);
-    free((char *) compressed_file);
+    auto now = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = now - stage_start;
+    stage_start = now;
+    return diff.count();
 }
 
-/*
- * Сервисные функции
- * */
-
-uint_fast32_t file_size(const char *name) {
-    /*
-     * Возвращает размер указанного файла в байтах
-     * */
-
-    std::ifstream f(name, std::ios::ate);
-    if (!f.is_open())
-        throw std::runtime_error("Can't open file\n");
-
-    uint_fast32_t size = f.tellg();
-
-    f.close();
-
-    return size;
+static int read_byte(FILE *input) {
+    TRACE_SCOPE_SAMPLED("read");
+    return getc(input);
 }
 
-void print_results(char *input, char *output) {
-    /*
-     * Вывод результатов
-     * */
-
-    uint_fast32_t input_size = file_size(input);
-    if (input_size == 0)
-        input_size = 1;
-
-    printf("\nSource filesize:\t%ld\n", input_size);
-
-    uint_fast32_t output_size = file_size(output);
-    printf("Target Filesize:\t%ld\n", output_size);
-
-    int ratio = 100 - (int) (output_size * 100L / input_size);
-    printf("Compression ratio:\t\t%d%%\n", ratio);
+static int write_byte(int c, FILE *output) {
+    TRACE_SCOPE_SAMPLED("write");
+    return putc(c, output);
 }
 
-void print_fatal_error(char *fmt) {
-    /*
-     * Вывод сообщения об ошибке
-     * */
-    printf("Fatal error: ");
-    printf("%s", fmt);
-    exit(-1);
-}
-
-void help() {
-    /*
-     * Вывод подсказки по использованию программой
-     * */
-    printf("HuffAdapt e(encoding)|d(decoding) input output\n");
-}
-
-Tree model_tree; // Модель кодирования
-
-/*
- * Основные функции адаптивного алгоритма Хаффмана
- * */
-
-void initialize_tree(Tree *tree);
-
-void encode_symbol(Tree *tree, unsigned int c, BIT_FILE *output);
-
-int decode_symbol(Tree *tree, BIT_FILE *input);
-
-void update_model(Tree *tree, int c);
-
-void rebuild_tree(Tree *tree);
-
-void swap_nodes(Tree *tree, int i, int j);
-
-void add_new_node(Tree *tree, int c);
-
 void MainWindow::encode(FILE *input, const std::string &filename) {
+    TRACE_SCOPE("encode");
+    TRACE_BLOCK(0);
+    auto stage_start = std::chrono::high_resolution_clock::now();
+    auto model = choose_model_params(filename, levelComboBox->currentData().toInt());
+    initialize_tree(&model_tree, model);
+
     auto source_file_size = file_size(filename.c_str());
     sourceFileSizeValue->setText(humanFileSize(source_file_size, true, 2));
 
     std::filesystem::path path(filename);
-    auto p = (std::stringstream() << path.parent_path().string() << "\\" << path.stem().string() << ".ahf").str();
+    auto p = target_filename(filename, "ahf");
     auto outFilename = p.c_str();
 
     BIT_FILE *output = open_output_bit_file(outFilename);
     if (output == nullptr)
         throw std::runtime_error("Error open target file.\n");
 
-    auto fileExtToEncode = path.extension().string().erase(0, 1);
-    for (unsigned char c: fileExtToEncode)
-        output_bits(output, c, 8);
-    output_bits(output, 0, 8);
+    auto deduplicate = dedupCheckBox->isChecked();
+    write_header(output, {.extension = path.extension().string().erase(0, 1),
+                          .flags = deduplicate ? AHF_FLAG_DEDUP : 0u,
+                          .model = model});
+    model_tree.stats.stage_seconds[STAGE_HEADER] = seconds_since(stage_start);
 
     uint_fast32_t processed_bytes = 0;
     int c;
 
-    initialize_tree(&model_tree);
-    while ((c = getc(input)) != EOF) {
-        ++processed_bytes;
-        progressBar->setValue(ceil(processed_bytes * 100.0 / source_file_size));
+    if (deduplicate) {
+        auto records = plan_chunks(filename, &model_tree.stats);
+        model_tree.stats.stage_seconds[STAGE_DEDUP] = seconds_since(stage_start);
 
-        encode_symbol(&model_tree, c, output);
-        update_model(&model_tree, c);
+        std::vector<unsigned char> chunk;
+        for (const auto &record: records) {
+            chunk.resize(record.length);
+            if (fread(chunk.data(), 1, chunk.size(), input) != chunk.size())
+                throw std::runtime_error("Error on input.\n");
+            TRACE_BLOCK(record.offset >> TRACE_BLOCK_SHIFT);
+
+            encode_chunk(&model_tree, output, record, chunk.data());
+
+            processed_bytes += record.length;
+            progressBar->setValue(ceil(processed_bytes * 100.0 / source_file_size));
+        }
+        encode_chunks_end(&model_tree, output);
+    } else {
+        while ((c = read_byte(input)) != EOF) {
+            if ((++processed_bytes & ((1 << TRACE_BLOCK_SHIFT) - 1)) == 0)
+                TRACE_BLOCK(processed_bytes >> TRACE_BLOCK_SHIFT);
+            progressBar->setValue(ceil(processed_bytes * 100.0 / source_file_size));
+
+            encode_symbol(&model_tree, c, output);
+            update_model(&model_tree, c);
+        }
+        encode_symbol(&model_tree, END_OF_STREAM, output);
     }
-    encode_symbol(&model_tree, END_OF_STREAM, output);
+    model_tree.stats.stage_seconds[STAGE_CODING] = seconds_since(stage_start);
 
-    close_output_bit_file(output);
+    {
+        TRACE_SCOPE("write");
+        close_output_bit_file(output);
+    }
+    model_tree.stats.stage_seconds[STAGE_FINALIZE] = seconds_since(stage_start);
 
     auto created_file_size = file_size(p.c_str());
     receivedFileSizeValue->setText(humanFileSize(created_file_size, true, 2));
     auto ratio = ceil(created_file_size * 100.0 / source_file_size);
     compressionRatioTextValue->setText(QString::number(ratio) + " %");
+
+    showStatistics();
 }
 
 void MainWindow::decode(BIT_FILE *input, const std::string &filename) {
+    TRACE_SCOPE("decode");
+    TRACE_BLOCK(0);
+    auto stage_start = std::chrono::high_resolution_clock::now();
+
     auto source_file_size = file_size(filename.c_str());
     sourceFileSizeValue->setText(humanFileSize(source_file_size, true, 2));
 
-    std::filesystem::path path(filename);
-
-    std::string ext;
-    unsigned char ch;
-    while (true) {
-        ch = input_bits(input, 8);
-
-        if (ch == '\0')
-            break;
-
-        ext += ch;
-    }
+    auto header = read_header(input);
+    Decoder decoder;
+    initialize_decoder(&decoder, &model_tree, input, header, filename);
 
-    auto p = (std::stringstream() << path.parent_path().string() << "\\" << path.stem().string() << "." << ext).str();
+    auto p = target_filename(filename, header.extension);
     auto outFilename = p.c_str();
 
     FILE *output = fopen(outFilename, "wb");
     if (output == nullptr)
         throw std::runtime_error("Error open target file.\n");
+    model_tree.stats.stage_seconds[STAGE_HEADER] = seconds_since(stage_start);
 
     uint_fast32_t processed_bytes = 0;
     int c;
 
-    initialize_tree(&model_tree);
-    while ((c = decode_symbol(&model_tree, input)) != END_OF_STREAM) {
-        ++processed_bytes;
+    while ((c = decode_next(&decoder)) != EOF) {
+        if ((++processed_bytes & ((1 << TRACE_BLOCK_SHIFT) - 1)) == 0)
+            TRACE_BLOCK(processed_bytes >> TRACE_BLOCK_SHIFT);
         progressBar->setValue(ceil(processed_bytes * 100.0 / source_file_size));
 
-        if (putc(c, output) == EOF)
+        if (write_byte(c, output) == EOF)
             throw std::runtime_error("Error on output.\n");
-        update_model(&model_tree, c);
     }
+    model_tree.stats.stage_seconds[STAGE_CODING] = seconds_since(stage_start);
 
-    fflush(output);
-    fclose(output);
+    {
+        TRACE_SCOPE("write");
+        fflush(output);
+        fclose(output);
+    }
+    model_tree.stats.stage_seconds[STAGE_FINALIZE] = seconds_since(stage_start);
 
     auto created_file_size = file_size(p.c_str());
     receivedFileSizeValue->setText(humanFileSize(created_file_size, true, 2));
     auto ratio = ceil(created_file_size * 100.0 / source_file_size);
     compressionRatioTextValue->setText(QString::number(ratio) + " %");
-}
-
-void initialize_tree(Tree *tree) {
-    /*
-     * Функция инициализации дерева.
-     * Перед началом работы алгоритма дерево кодирования
-     * инициализируется двумя специальными (не ASCII) символами:
-     * ESCAPE и END_OF_STREAM.
-     * Также инициализируется корень дерева.
-     * Все листья инициализируются -1, так как они еще
-     * не присутствуют в дереве кодирования.
-     * */
-
-    tree->nodes[ROOT_NODE].child = ROOT_NODE + 1;
-    tree->nodes[ROOT_NODE].child_is_leaf = false;
-    tree->nodes[ROOT_NODE].weight = 2;
-    tree->nodes[ROOT_NODE].parent = -1;
-
-    tree->nodes[ROOT_NODE + 1].child = END_OF_STREAM;
-    tree->nodes[ROOT_NODE + 1].child_is_leaf = true;
-    tree->nodes[ROOT_NODE + 1].weight = 1;
-    tree->nodes[ROOT_NODE + 1].parent = ROOT_NODE;
-    tree->leaf[END_OF_STREAM] = ROOT_NODE + 1;
-
-    tree->nodes[ROOT_NODE + 2].child = ESCAPE;
-    tree->nodes[ROOT_NODE + 2].child_is_leaf = true;
-    tree->nodes[ROOT_NODE + 2].weight = 1;
-    tree->nodes[ROOT_NODE + 2].parent = ROOT_NODE;
-    tree->leaf[ESCAPE] = ROOT_NODE + 2;
-
-    tree->next_free_node = ROOT_NODE + 3;
-
-    for (int i = 0; i < END_OF_STREAM; ++i)
-        tree->leaf[i] = -1;
-}
-
-void encode_symbol(Tree *tree, unsigned int c, BIT_FILE *output) {
-    /*
-     * Преобразует входной символ в последовательность
-     * битов на основе текущего состояния дерева кодирования.
-     * Некоторое неудобство состоит в том, что, обходя дерево
-     * от листа к корню, мы получаем последовательность битов
-     * в обратном порядке, и поэтому необходимо аккумулировать биты
-     * в INTEGER переменной и выдавать их после того, как обход
-     * дерева закончен.
-     * */
-
-    unsigned long code = 0;
-    unsigned long current_bit = 1;
-    int code_size = 0;
-    int current_node = tree->leaf[c];
-
-    if (current_node == -1)
-        current_node = tree->leaf[ESCAPE];
 
-    while (current_node != ROOT_NODE) {
-        if ((current_node & 1) == 0)
-            code |= current_bit;
-        current_bit <<= 1;
-        ++code_size;
-        current_node = tree->nodes[current_node].parent;
-    }
-
-    output_bits(output, code, code_size);
-
-    if (tree->leaf[c] == -1) {
-        output_bits(output, (unsigned long) c, 8);
-        add_new_node(tree, c);
-    }
-}
-
-int decode_symbol(Tree *tree, BIT_FILE *input) {
-    /*
-     * Процедура декодирования очень проста. Начиная от корня, мы
-     * обходим дерево, пока не дойдем до листа. Затем проверяем
-     * не прочитали ли мы ESCAPE код. Если да, то следующие 8 битов
-     * соответствуют незакодированному символу, который немедленно
-     * считывается и добавляется к таблице.
-     * */
-
-    int current_node;
-    int c;
-
-    current_node = ROOT_NODE;
-    while (!tree->nodes[current_node].child_is_leaf) {
-        current_node = tree->nodes[current_node].child;
-        current_node += input_bit(input);
-    }
-    c = tree->nodes[current_node].child;
-    if (c == ESCAPE) {
-        c = (int) input_bits(input, 8);
-        add_new_node(tree, c);
-    }
-    return (c);
-}
-
-void update_model(Tree *tree, int c) {
-    /*
-     * Процедура обновления модели кодирования для данного символа.
-     * */
-
-    int current_node;
-    int new_node;
-
-    if (tree->nodes[ROOT_NODE].weight == MAX_WEIGHT)
-        rebuild_tree(tree);
-
-    current_node = tree->leaf[c];
-    while (current_node != -1) {
-        tree->nodes[current_node].weight++;
-
-        for (new_node = current_node; new_node > ROOT_NODE; new_node--)
-            if (tree->nodes[new_node - 1].weight >=
-                tree->nodes[current_node].weight)
-                break;
-
-        if (current_node != new_node) {
-            swap_nodes(tree, current_node, new_node);
-            current_node = new_node;
-        }
-
-        current_node = tree->nodes[current_node].parent;
-    }
-}
-
-void rebuild_tree(Tree *tree) {
-    /*
-     * Процедура перестроения дерева вызывается тогда, когда
-     * вес корня дерева достигает пороговой величины. Она
-     * начинается с простого деления весов узлов на 2. Но из-за
-     * ошибок округления при этом может быть нарушено свойство
-     * упорядоченности дерева кодирования, и необходимы
-     * дополнительные усилия, чтобы привести его в корректное
-     * состояние.
-     * */
-
-    int i;
-    int j;
-    int k;
-    unsigned int weight;
-
-    printf("R");
-    j = tree->next_free_node - 1;
-    for (i = j; i >= ROOT_NODE; i--) {
-        if (tree->nodes[i].child_is_leaf) {
-            tree->nodes[j] = tree->nodes[i];
-            tree->nodes[j].weight =
-                    (tree->nodes[j].weight + 1) / 2;
-            j--;
-        }
-    }
-
-    for (i = tree->next_free_node - 2; j >= ROOT_NODE; i -= 2, j--) {
-        k = i + 1;
-        tree->nodes[j].weight =
-                tree->nodes[i].weight + tree->nodes[k].weight;
-        weight = tree->nodes[j].weight;
-        tree->nodes[j].child_is_leaf = 0;
-        for (k = j + 1; weight < tree->nodes[k].weight; k++);
-        k--;
-        memmove(&tree->nodes[j], &tree->nodes[j + 1],
-                (k - j) * sizeof(struct Node));
-        tree->nodes[k].weight = weight;
-        tree->nodes[k].child = i;
-        tree->nodes[k].child_is_leaf = 0;
-    }
-
-    for (i = tree->next_free_node - 1; i >= ROOT_NODE; i--) {
-        if (tree->nodes[i].child_is_leaf) {
-            k = tree->nodes[i].child;
-            tree->leaf[k] = i;
-        } else {
-            k = tree->nodes[i].child;
-            tree->nodes[k].parent =
-            tree->nodes[k + 1].parent = i;
-        }
-    }
-}
-
-void swap_nodes(Tree *tree, int i, int j) {
-    /*
-     * Процедура перестановки узлов дерева вызывается тогда, когда
-     * очередное увеличение веса узла привело к нарушению свойства
-     * упорядоченности.
-     * */
-
-    Node temp{};
-
-    if (tree->nodes[i].child_is_leaf)
-        tree->leaf[tree->nodes[i].child] = j;
-    else {
-        tree->nodes[tree->nodes[i].child].parent = j;
-        tree->nodes[tree->nodes[i].child + 1].parent = j;
-    }
-    if (tree->nodes[j].child_is_leaf)
-        tree->leaf[tree->nodes[j].child] = i;
-    else {
-        tree->nodes[tree->nodes[j].child].parent = i;
-        tree->nodes[tree->nodes[j].child + 1].parent = i;
-    }
-    temp = tree->nodes[i];
-    tree->nodes[i] = tree->nodes[j];
-    tree->nodes[i].parent = temp.parent;
-    temp.parent = tree->nodes[j].parent;
-    tree->nodes[j] = temp;
-}
-
-void add_new_node(Tree *tree, int c) {
-    /*
-     * Для добавления самый легкий узел дерева разбивается на 2,
-     * один из которых и есть тот новый узел.
-     * Новому узлу присваивается вес 0, который будет изменен потом,
-     * при нормальном процессе обновления дерева.
-     * */
-
-    uint_fast32_t lightest_node = tree->next_free_node - 1;
-    uint_fast32_t new_node = tree->next_free_node;
-    uint_fast32_t zero_weight_node = tree->next_free_node + 1;
-    tree->next_free_node += 2;
-
-    tree->nodes[new_node] = tree->nodes[lightest_node];
-    tree->nodes[new_node].parent = lightest_node;
-    tree->leaf[tree->nodes[new_node].child] = new_node;
-
-    tree->nodes[lightest_node].child = new_node;
-    tree->nodes[lightest_node].child_is_leaf = false;
-
-    tree->nodes[zero_weight_node].child = c;
-    tree->nodes[zero_weight_node].child_is_leaf = true;
-    tree->nodes[zero_weight_node].weight = 0;
-    tree->nodes[zero_weight_node].parent = lightest_node;
-    tree->leaf[c] = zero_weight_node;
+    showStatistics();
 }
 
 /*
@@ -599,9 +164,13 @@ MainWindow::MainWindow() {
     centralLayout->addWidget(selectedFileName, 0, 1);
 
     selectFileButton = new QPushButton(tr("Select"));
-    centralLayout->addWidget(selectFileButton, 1, 0, 1, 2);
+    centralLayout->addWidget(selectFileButton, 1, 0);
     connect(selectFileButton, SIGNAL(clicked(bool)), this, SLOT(openFileDialog()));
 
+    verifyButton = new QPushButton(tr("Verify"));
+    centralLayout->addWidget(verifyButton, 1, 1);
+    connect(verifyButton, SIGNAL(clicked(bool)), this, SLOT(verifyArchives()));
+
     startButton = new QPushButton(tr("Start"));
     centralLayout->addWidget(startButton, 2, 0);
 
@@ -612,39 +181,116 @@ MainWindow::MainWindow() {
                 this->close();
             });
 
+    searchButton = new QPushButton(tr("Search"));
+    searchButton->setToolTip(tr("Find strings inside .ahf files without unpacking them"));
+    centralLayout->addWidget(searchButton, 3, 0);
+    connect(searchButton, SIGNAL(clicked(bool)), this, SLOT(searchArchives()));
+
+    firstMatchCheckBox = new QCheckBox(tr("First match only"));
+    centralLayout->addWidget(firstMatchCheckBox, 3, 1);
+
+    dedupCheckBox = new QCheckBox(tr("Deduplicate"));
+    dedupCheckBox->setToolTip(tr("Replace repeated content-defined chunks with references"));
+    centralLayout->addWidget(dedupCheckBox, 4, 0);
+
+    levelComboBox = new QComboBox;
+    levelComboBox->addItem(tr("Level 1 - fast"), LEVEL_FAST);
+    levelComboBox->addItem(tr("Level 2 - normal"), LEVEL_NORMAL);
+    levelComboBox->addItem(tr("Level 3 - adaptive"), LEVEL_ADAPTIVE);
+    levelComboBox->addItem(tr("Level 4 - best (trial)"), LEVEL_BEST);
+    levelComboBox->setCurrentIndex(levelComboBox->findData(DEFAULT_COMPRESSION_LEVEL));
+    levelComboBox->setToolTip(tr("Model rescale policy: lower levels are faster, "
+                                 "higher levels adapt faster to changing data"));
+    centralLayout->addWidget(levelComboBox, 4, 1);
+
+    estimateLabel = new QLabel(tr("Estimate: "));
+    centralLayout->addWidget(estimateLabel, 5, 0);
+    estimateValue = new QLabel("-");
+    estimateValue->setToolTip(tr("Predicted size, ratio and time from a sample of the file"));
+    centralLayout->addWidget(estimateValue, 5, 1);
+    connect(levelComboBox, SIGNAL(currentIndexChanged(int)), this, SLOT(updateEstimate()));
+
     elapsedTimeLabel = new QLabel(tr("Elapsed time: "));
-    centralLayout->addWidget(elapsedTimeLabel, 3, 0);
+    centralLayout->addWidget(elapsedTimeLabel, 6, 0);
 
     elapsedTimeTextValue = new QLabel(tr("00:00:00:00"));
-    centralLayout->addWidget(elapsedTimeTextValue, 3, 1);
+    centralLayout->addWidget(elapsedTimeTextValue, 6, 1);
 
     sourceFileSize = new QLabel(tr("Source size: "));
-    centralLayout->addWidget(sourceFileSize, 4, 0);
+    centralLayout->addWidget(sourceFileSize, 7, 0);
     sourceFileSizeValue = new QLabel(tr("0 B"));
-    centralLayout->addWidget(sourceFileSizeValue, 4, 1);
+    centralLayout->addWidget(sourceFileSizeValue, 7, 1);
 
     receivedFileSize = new QLabel(tr("Received size: "));
-    centralLayout->addWidget(receivedFileSize, 5, 0);
+    centralLayout->addWidget(receivedFileSize, 8, 0);
     receivedFileSizeValue = new QLabel(tr("0 B"));
-    centralLayout->addWidget(receivedFileSizeValue, 5, 1);
+    centralLayout->addWidget(receivedFileSizeValue, 8, 1);
 
     compressionRatioLabel = new QLabel(tr("Compression ratio: "));
-    centralLayout->addWidget(compressionRatioLabel, 6, 0);
+    centralLayout->addWidget(compressionRatioLabel, 9, 0);
 
     compressionRatioTextValue = new QLabel(tr("0 %"));
-    centralLayout->addWidget(compressionRatioTextValue, 6, 1);
+    centralLayout->addWidget(compressionRatioTextValue, 9, 1);
 
     progressBar = new QProgressBar;
     progressBar->setMaximum(100);
-    centralLayout->addWidget(progressBar, 7, 0, 1, 2);
+    centralLayout->addWidget(progressBar, 10, 0, 1, 2);
+
+    statisticsButton = new QPushButton(tr("Statistics"));
+    statisticsButton->setCheckable(true);
+    centralLayout->addWidget(statisticsButton, 11, 0, 1, 2);
+    connect(statisticsButton, SIGNAL(toggled(bool)), this, SLOT(toggleStatisticsPanel(bool)));
+
+    statisticsValue = new QLabel;
+    statisticsValue->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    statisticsValue->setAlignment(Qt::AlignTop | Qt::AlignLeft);
+    statisticsValue->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    statisticsValue->setWordWrap(true);
+    centralLayout->addWidget(statisticsValue, 12, 0, 1, 2);
+
+    exportStatisticsButton = new QPushButton(tr("Export JSON"));
+    centralLayout->addWidget(exportStatisticsButton, 13, 0, 1, 2);
+    connect(exportStatisticsButton, SIGNAL(clicked(bool)), this, SLOT(exportStatistics()));
+
+    queueList = new QListWidget;
+    centralLayout->addWidget(queueList, 14, 0, 1, 2);
+
+    runQueueButton = new QPushButton(tr("Run queue"));
+    centralLayout->addWidget(runQueueButton, 15, 0);
+    connect(runQueueButton, SIGNAL(clicked(bool)), this, SLOT(runQueue()));
+
+    throughputValue = new QLabel(tr("0 B/s"));
+    centralLayout->addWidget(throughputValue, 15, 1);
+
+    queueTimer = new QTimer(this);
+    connect(queueTimer, SIGNAL(timeout()), this, SLOT(updateQueue()));
+
+    archiveTimer = new QTimer(this);
+    connect(archiveTimer, SIGNAL(timeout()), this, SLOT(updateArchiveCheck()));
+
+    setAcceptDrops(true);
+
     QPalette p = palette();
     p.setColor(QPalette::Highlight, Qt::darkCyan);
     setPalette(p);
 
+    initialize_tree(&model_tree);
+    showStatistics();
+    updateWindowSize();
+
     connectMethodDependMode();
 }
 
 MainWindow::~MainWindow() {
+    pool.reset();
+    delete archiveTimer;
+    delete queueTimer;
+    delete throughputValue;
+    delete runQueueButton;
+    delete queueList;
+    delete exportStatisticsButton;
+    delete statisticsValue;
+    delete statisticsButton;
     delete sourceFileSize;
     delete sourceFileSizeValue;
     delete receivedFileSize;
@@ -656,7 +302,14 @@ MainWindow::~MainWindow() {
     delete elapsedTimeLabel;
     delete selectedFileName;
     delete selectFileButton;
+    delete verifyButton;
+    delete searchButton;
+    delete firstMatchCheckBox;
     delete closeButton;
+    delete dedupCheckBox;
+    delete levelComboBox;
+    delete estimateLabel;
+    delete estimateValue;
     delete centralLayout;
     delete centralWidget;
 }
@@ -665,7 +318,13 @@ void MainWindow::openFileDialog() {
     auto dialog = QFileDialog(this);
     dialog.setFileMode(QFileDialog::AnyFile);
 
-    auto filename = dialog.getOpenFileName();
+    auto filenames = dialog.getOpenFileNames();
+    if (filenames.size() > 1) {
+        enqueueFiles(filenames);
+        return;
+    }
+
+    auto filename = filenames.isEmpty() ? QString() : filenames.front();
     QFileInfo fi(filename);
     selectedFullFilename = filename.toStdString();
     filename = fi.fileName();
@@ -674,6 +333,183 @@ void MainWindow::openFileDialog() {
     setWorkingModeDependFileExt(ext);
 }
 
+void MainWindow::verifyArchives() {
+    /*
+     * Файлы проверяются в пуле по задаче на файл,
+     * ход проверки и отчет показывает updateArchiveCheck
+     * */
+
+    if (archiveCheck)
+        return;
+
+    auto filenames = QFileDialog::getOpenFileNames(this, tr("Verify archives"), {}, "Adaptive Huffman (*.ahf)");
+    if (filenames.isEmpty())
+        return;
+
+    archiveCheck = std::make_unique<ArchiveCheck>();
+    auto check = archiveCheck.get();
+    for (const auto &filename: filenames)
+        check->filenames.push_back(filename.toStdString());
+    check->results.resize(check->filenames.size());
+    check->start = std::chrono::high_resolution_clock::now();
+
+    if (!pool)
+        pool = std::make_unique<WorkStealingPool>();
+
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < check->filenames.size(); ++i)
+        tasks.emplace_back([check, i] {
+            TRACE_BLOCK((int64_t) i);
+            check->results[i] = verify_archive(check->filenames[i]);
+            ++check->done;
+        });
+    pool->submit(std::move(tasks));
+
+    progressBar->setValue(0);
+    setArchiveCheckRunning(true);
+    archiveTimer->start(200);
+}
+
+void MainWindow::updateArchiveCheck() {
+    if (!archiveCheck)
+        return;
+
+    const auto &check = *archiveCheck;
+    size_t done = check.done;
+    progressBar->setValue((int) (done * 100 / check.filenames.size()));
+    setElapsedTime(check.start, std::chrono::high_resolution_clock::now());
+    if (done < check.filenames.size())
+        return;
+
+    archiveTimer->stop();
+    if (check.search)
+        showSearchReport();
+    else
+        showVerifyReport();
+    archiveCheck.reset();
+    setArchiveCheckRunning(false);
+}
+
+void MainWindow::setArchiveCheckRunning(bool running) {
+    /*
+     * Пока идет проверка или поиск, второй не запускается, а очередь не стартует:
+     * runQueue ждет опустошения пула
+     * */
+
+    verifyButton->setEnabled(!running);
+    searchButton->setEnabled(!running);
+    runQueueButton->setEnabled(!running);
+}
+
+void MainWindow::showVerifyReport() {
+    const auto &results = archiveCheck->results;
+
+    QString report;
+    int failed = 0;
+    for (const auto &result: results) {
+        auto name = QFileInfo(QString::fromStdString(result.filename)).fileName();
+        if (result.ok)
+            report += QString("%1: OK, %2, CRC-32 %3\n")
+                    .arg(name)
+                    .arg(humanFileSize(result.decoded_size, true, 2))
+                    .arg(result.checksum, 8, 16, QChar('0'));
+        else {
+            report += QString("%1: FAILED, %2\n").arg(name, QString::fromStdString(result.error));
+            ++failed;
+        }
+    }
+
+    if (results.size() == 1) {
+        model_tree.stats = results.front().stats;
+        showStatistics();
+    }
+
+    if (failed == 0)
+        QMessageBox::information(this, tr("Verify"), report);
+    else
+        QMessageBox::warning(this, tr("Verify"), report);
+}
+
+void MainWindow::searchArchives() {
+    /*
+     * Как verifyArchives: поиск в пуле по задаче на файл
+     * с одним автоматом на все файлы
+     * */
+
+    if (archiveCheck)
+        return;
+
+    bool ok = false;
+    auto text = QInputDialog::getMultiLineText(this, tr("Search"), tr("Patterns, one per line:"), {}, &ok);
+    if (!ok)
+        return;
+
+    std::vector<std::string> patterns;
+    for (const auto &pattern: text.split('\n', Qt::SkipEmptyParts))
+        patterns.push_back(pattern.toStdString());
+    if (patterns.empty())
+        return;
+
+    auto filenames = QFileDialog::getOpenFileNames(this, tr("Search archives"), {}, "Adaptive Huffman (*.ahf)");
+    if (filenames.isEmpty())
+        return;
+
+    archiveCheck = std::make_unique<ArchiveCheck>();
+    auto check = archiveCheck.get();
+    for (const auto &filename: filenames)
+        check->filenames.push_back(filename.toStdString());
+    check->search = true;
+    check->matcher = build_matcher(patterns);
+    check->patterns = std::move(patterns);
+    check->first_match_only = firstMatchCheckBox->isChecked();
+    check->matches.resize(check->filenames.size());
+    check->start = std::chrono::high_resolution_clock::now();
+
+    if (!pool)
+        pool = std::make_unique<WorkStealingPool>();
+
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < check->filenames.size(); ++i)
+        tasks.emplace_back([check, i] {
+            TRACE_BLOCK((int64_t) i);
+            check->matches[i] = search_archive(check->filenames[i], check->matcher, check->first_match_only);
+            ++check->done;
+        });
+    pool->submit(std::move(tasks));
+
+    progressBar->setValue(0);
+    setArchiveCheckRunning(true);
+    archiveTimer->start(200);
+}
+
+void MainWindow::showSearchReport() {
+    const auto &check = *archiveCheck;
+
+    QString report;
+    int failed = 0;
+    for (const auto &result: check.matches) {
+        auto name = QFileInfo(QString::fromStdString(result.filename)).fileName();
+        if (!result.ok) {
+            report += QString("%1: FAILED, %2\n").arg(name, QString::fromStdString(result.error));
+            ++failed;
+            continue;
+        }
+
+        report += QString("%1: %2 match(es)\n").arg(name).arg(result.match_count);
+        for (size_t i = 0; i < result.matches.size() && i < SEARCH_REPORT_LIMIT; ++i)
+            report += QString("  %1 at %2\n")
+                    .arg(QString::fromStdString(check.patterns[result.matches[i].pattern]))
+                    .arg(result.matches[i].offset);
+        if (result.match_count > SEARCH_REPORT_LIMIT)
+            report += "  ...\n";
+    }
+
+    if (failed == 0)
+        QMessageBox::information(this, tr("Search"), report);
+    else
+        QMessageBox::warning(this, tr("Search"), report);
+}
+
 void MainWindow::connectMethodDependMode() {
     startButton->disconnect();
 
@@ -709,6 +545,166 @@ void MainWindow::connectMethodDependMode() {
                 });
 }
 
+const CodecStats &MainWindow::statistics() const {
+    return model_tree.stats;
+}
+
+void MainWindow::toggleStatisticsPanel(bool) {
+    updateWindowSize();
+}
+
+void MainWindow::updateWindowSize() {
+    auto statisticsExpanded = statisticsButton->isChecked();
+    statisticsValue->setVisible(statisticsExpanded);
+    exportStatisticsButton->setVisible(statisticsExpanded);
+
+    auto queueExpanded = !jobs.empty();
+    queueList->setVisible(queueExpanded);
+    runQueueButton->setVisible(queueExpanded);
+    throughputValue->setVisible(queueExpanded);
+
+    auto height = WINDOW_HEIGHT +
+                  (statisticsExpanded ? STATISTICS_PANEL_HEIGHT : 0) +
+                  (queueExpanded ? QUEUE_PANEL_HEIGHT : 0);
+    centralWidget->setFixedSize(WINDOW_WIDTH, height);
+    setFixedSize(WINDOW_WIDTH, height);
+}
+
+void MainWindow::dragEnterEvent(QDragEnterEvent *event) {
+    if (event->mimeData()->hasUrls())
+        event->acceptProposedAction();
+}
+
+void MainWindow::dropEvent(QDropEvent *event) {
+    QStringList filenames;
+    for (const auto &url: event->mimeData()->urls())
+        if (!url.toLocalFile().isEmpty())
+            filenames.append(url.toLocalFile());
+
+    enqueueFiles(filenames);
+    event->acceptProposedAction();
+}
+
+void MainWindow::enqueueFiles(const QStringList &filenames) {
+    for (const auto &filename: filenames) {
+        try {
+            jobs.push_back(make_batch_job(filename.toStdString(), dedupCheckBox->isChecked(),
+                                          levelComboBox->currentData().toInt(), jobs));
+            queueList->addItem(new QListWidgetItem);
+        } catch (const std::runtime_error &e) {
+            QMessageBox::warning(this, tr("Queue"), filename + ": " + QString::fromStdString(e.what()));
+        }
+    }
+
+    updateQueue();
+    updateWindowSize();
+}
+
+void MainWindow::runQueue() {
+    if (submittedJobs == jobs.size())
+        return;
+
+    if (!pool)
+        pool = std::make_unique<WorkStealingPool>();
+    if (!queueTimer->isActive()) {
+        /* Предыдущий запуск завершен: задачи упавших заданий могли еще не выйти из пула */
+        pool->wait();
+        queueStart = std::chrono::steady_clock::now();
+        jobs.erase(jobs.begin(), jobs.begin() + (std::ptrdiff_t) submittedJobs);
+        submittedJobs = 0;
+        queueList->clear();
+        for (size_t i = 0; i < jobs.size(); ++i)
+            queueList->addItem(new QListWidgetItem);
+    }
+
+    std::vector<BatchJob *> run;
+    for (; submittedJobs < jobs.size(); ++submittedJobs)
+        run.push_back(jobs[submittedJobs].get());
+    submit_batch_run(pool.get(), run);
+
+    queueTimer->start(200);
+    updateQueue();
+}
+
+void MainWindow::updateQueue() {
+    /*
+     * Опрос состояния заданий: рабочие потоки только обновляют
+     * атомарные счетчики, интерфейс читает их по таймеру
+     * */
+
+    uint_fast64_t processed = 0;
+    bool running = false;
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const auto &job = *jobs[i];
+        auto name = QFileInfo(QString::fromStdString(job.filename)).fileName();
+        auto mode = job.decode ? tr("decode") : tr("encode");
+        int state = job.state;
+
+        QString status;
+        if (state == JOB_DONE)
+            status = tr("done");
+        else if (state == JOB_FAILED)
+            status = tr("failed: ") + QString::fromStdString(job.error);
+        else if (i >= submittedJobs)
+            status = tr("queued");
+        else {
+            auto percent = job.total_bytes == 0 ? 100 : job.processed_bytes * 100 / job.total_bytes;
+            status = QString::number(percent) + " %";
+            running = true;
+        }
+
+        queueList->item((int) i)->setText(name + " [" + mode + "] " + status);
+        processed += job.processed_bytes;
+    }
+
+    if (submittedJobs > 0) {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - queueStart;
+        auto rate = elapsed.count() > 0 ? processed / elapsed.count() : 0.0;
+        throughputValue->setText(humanFileSize((uint_fast32_t) rate, true, 2) + "/s");
+    }
+
+    if (!running)
+        queueTimer->stop();
+}
+
+void MainWindow::exportStatistics() {
+    auto filename = QFileDialog::getSaveFileName(this, tr("Export statistics"), "stats.json", "JSON (*.json)");
+    if (filename.isEmpty())
+        return;
+
+    std::ofstream out(filename.toStdString());
+    if (!out.is_open())
+        throw std::runtime_error("Error open statistics file.\n");
+    out << codec_stats_to_json(model_tree.stats) << "\n";
+}
+
+void MainWindow::showStatistics() {
+    const auto &stats = model_tree.stats;
+
+    QString depths;
+    for (int depth = 0; depth < MAX_TREE_DEPTH; ++depth)
+        if (stats.depth_histogram[depth] != 0)
+            depths += QString(" %1:%2").arg(depth).arg(stats.depth_histogram[depth]);
+
+    statisticsValue->setText(
+            tr("Symbols:   ") + QString::number(stats.symbols) + "\n" +
+            tr("Escapes:   ") + QString::number(stats.escapes) + "\n" +
+            tr("Rescales:  ") + QString::number(stats.rescales) + "\n" +
+            tr("Swaps:     ") + QString::number(stats.swaps) + "\n" +
+            tr("Avg code:  ") + QString::number(average_code_length(stats), 'f', 3) + tr(" bit") + "\n" +
+            tr("Depths:   ") + depths + "\n" +
+            tr("Chunks:    ") + QString::number(stats.chunks) +
+            tr(", duplicate ") + QString::number(stats.duplicate_chunks) + "\n" +
+            tr("Dup bytes: ") + humanFileSize(stats.duplicate_bytes, true, 2) +
+            tr(", dictionary ") + humanFileSize(stats.dictionary_bytes, true, 2) + "\n" +
+            tr("Header:    ") + QString::number(stats.stage_seconds[STAGE_HEADER], 'f', 3) + " s\n" +
+            tr("Dedup:     ") + QString::number(stats.stage_seconds[STAGE_DEDUP], 'f', 3) + " s\n" +
+            tr("Coding:    ") + QString::number(stats.stage_seconds[STAGE_CODING], 'f', 3) + " s\n" +
+            tr("Finalize:  ") + QString::number(stats.stage_seconds[STAGE_FINALIZE], 'f', 3) + " s"
+    );
+}
+
 void MainWindow::setWorkingModeDependFileExt(const QString &ext) {
     if (ext == "ahf")
         MODE = DECODE;
@@ -716,6 +712,27 @@ void MainWindow::setWorkingModeDependFileExt(const QString &ext) {
         MODE = ENCODE;
 
     connectMethodDependMode();
+    updateEstimate();
+}
+
+void MainWindow::updateEstimate() {
+    /*
+     * Прогноз по выборке до запуска, только для сжатия
+     * */
+
+    if (MODE != ENCODE || selectedFullFilename.empty()) {
+        estimateValue->setText("-");
+        return;
+    }
+
+    try {
+        auto estimate = estimate_compression(selectedFullFilename, levelComboBox->currentData().toInt());
+        estimateValue->setText("~" + humanFileSize(estimate.predicted_size, true, 2) + ", " +
+                               QString::number(ceil(estimate.ratio)) + " %, " +
+                               formatTime(estimate.seconds));
+    } catch (const std::runtime_error &e) {
+        estimateValue->setText("-");
+    }
 }
 
 QString MainWindow::humanFileSize(const uint_fast32_t &bytes,
@@ -748,7 +765,11 @@ QString MainWindow::humanFileSize(const uint_fast32_t &bytes,
 void MainWindow::setElapsedTime(std::chrono::time_point<std::chrono::high_resolution_clock> start,
                                 std::chrono::time_point<std::chrono::high_resolution_clock> end) {
     std::chrono::duration<double> diff = end - start;
-    int ms = diff.count() * 1000;
+    elapsedTimeTextValue->setText(formatTime(diff.count()));
+}
+
+QString MainWindow::formatTime(double seconds) {
+    int ms = seconds * 1000;
     int x = ms / 1000;
     int s = x % 60;
     x /= 60;
@@ -756,10 +777,8 @@ void MainWindow::setElapsedTime(std::chrono::time_point<std::chrono::high_resolu
     x /= 60;
     int h = x % 24;
 
-    elapsedTimeTextValue->setText(
-            QString::number(h) + ":" +
-            QString::number(m) + ":" +
-            QString::number(s) + ":" +
-            QString::number(ms % 1000)
-    );
+    return QString::number(h) + ":" +
+           QString::number(m) + ":" +
+           QString::number(s) + ":" +
+           QString::number(ms % 1000);
 }
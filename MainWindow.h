@@ -24,17 +24,22 @@
 #include <QProgressBar>
 #include <QMenu>
 #include <QContextMenuEvent>
-
-struct BIT_FILE {
-    /*
-     * Структура побитового доступа к файлу
-     * */
-
-    FILE *file;
-    unsigned char mask;
-    int rack;
-    int pacifier_counter;
-};
+#include <QFontDatabase>
+#include <QMessageBox>
+#include <QListWidget>
+#include <QCheckBox>
+#include <QComboBox>
+#include <QInputDialog>
+#include <QTimer>
+#include <QMimeData>
+#include <QDragEnterEvent>
+#include <QDropEvent>
+
+#include "HuffAdapt.h"
+#include "Batch.h"
+#include "Dedup.h"
+#include "Search.h"
+#include "WorkStealingPool.h"
 
 class MainWindow final : public QMainWindow {
 Q_OBJECT
@@ -43,14 +48,39 @@ public:
 
     ~MainWindow() override;
 
+    const CodecStats &statistics() const;
+
 public slots:
 
     void openFileDialog();
 
     void connectMethodDependMode();
 
+    void verifyArchives();
+
+    void searchArchives();
+
+    void toggleStatisticsPanel(bool expanded);
+
+    void exportStatistics();
+
+    void enqueueFiles(const QStringList &filenames);
+
+    void runQueue();
+
+    void updateQueue();
+
+    void updateEstimate();
+
+    void updateArchiveCheck();
+
+protected:
+    void dragEnterEvent(QDragEnterEvent *event) override;
+
+    void dropEvent(QDropEvent *event) override;
+
 private:
-    const qint32 WINDOW_WIDTH = 300, WINDOW_HEIGHT = 200;
+    const qint32 WINDOW_WIDTH = 300, WINDOW_HEIGHT = 260, STATISTICS_PANEL_HEIGHT = 240, QUEUE_PANEL_HEIGHT = 160;
     const QString WINDOW_TITLE = "ZipFile";
     QGraphicsView *centralWidget;
     QGridLayout *centralLayout;
@@ -58,8 +88,15 @@ private:
     QLabel *selectedFileName;
     std::string selectedFullFilename;
     QPushButton *selectFileButton;
+    QPushButton *verifyButton;
+    QPushButton *searchButton;
+    QCheckBox *firstMatchCheckBox;
     QPushButton *startButton;
     QPushButton *closeButton;
+    QCheckBox *dedupCheckBox;
+    QComboBox *levelComboBox;
+    QLabel *estimateLabel;
+    QLabel *estimateValue;
     QLabel *elapsedTimeLabel;
     QLabel *elapsedTimeTextValue;
     QLabel *compressionRatioLabel;
@@ -69,6 +106,37 @@ private:
     QLabel *sourceFileSizeValue;
     QLabel *receivedFileSize;
     QLabel *receivedFileSizeValue;
+    QPushButton *statisticsButton;
+    QLabel *statisticsValue;
+    QPushButton *exportStatisticsButton;
+    QListWidget *queueList;
+    QPushButton *runQueueButton;
+    QLabel *throughputValue;
+    QTimer *queueTimer;
+    QTimer *archiveTimer;
+
+    struct ArchiveCheck {
+        /*
+         * Проверка или поиск по сжатым файлам в пуле: задача на файл
+         * пишет свой результат и увеличивает done, интерфейс читает по таймеру
+         * */
+
+        std::vector<std::string> filenames;
+        bool search = false;
+        std::vector<VerifyResult> results;
+        std::vector<std::string> patterns;
+        PatternMatcher matcher;
+        bool first_match_only = false;
+        std::vector<SearchResult> matches;
+        std::atomic<size_t> done{0};
+        std::chrono::time_point<std::chrono::high_resolution_clock> start;
+    };
+
+    std::vector<std::unique_ptr<BatchJob>> jobs;
+    std::unique_ptr<ArchiveCheck> archiveCheck;
+    size_t submittedJobs = 0;
+    std::chrono::time_point<std::chrono::steady_clock> queueStart;
+    std::unique_ptr<WorkStealingPool> pool; // Объявлен после jobs и archiveCheck, чтобы остановиться раньше них
 
     enum WORKING_MODES {
         ENCODE, DECODE
@@ -85,8 +153,20 @@ private:
                           const bool &si,
                           const uint_fast32_t &precision);
 
+    void showStatistics();
+
+    void showVerifyReport();
+
+    void showSearchReport();
+
+    void setArchiveCheckRunning(bool running);
+
+    void updateWindowSize();
+
     void setElapsedTime(std::chrono::time_point<std::chrono::high_resolution_clock> start,
                         std::chrono::time_point<std::chrono::high_resolution_clock> end);
+
+    QString formatTime(double seconds);
 };
 
 
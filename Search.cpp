@@ -0,0 +1,146 @@
+#include "Search.h"
+#include "Trace.h"
+#include "WorkStealingPool.h"
+
+#include <memory>
+#include <queue>
+
+PatternMatcher build_matcher(const std::vector<std::string> &patterns) {
+    /*
+     * Построение автомата: бор образцов, затем обход в ширину,
+     * при котором недостающие переходы берутся из состояния
+     * по суффиксной ссылке. Пустые образцы пропускаются.
+     * */
+
+    PatternMatcher matcher;
+    std::vector<int32_t> fail;
+
+    auto add_state = [&] {
+        matcher.next.emplace_back();
+        matcher.next.back().fill(-1);
+        matcher.pattern.push_back(-1);
+        matcher.output_link.push_back(-1);
+        fail.push_back(0);
+        return (int32_t) matcher.next.size() - 1;
+    };
+
+    add_state();
+    bool empty = true;
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        matcher.lengths.push_back(patterns[i].size());
+        if (patterns[i].empty())
+            continue;
+        empty = false;
+
+        int32_t state = 0;
+        for (unsigned char c: patterns[i]) {
+            if (matcher.next[state][c] == -1) {
+                auto created = add_state();
+                matcher.next[state][c] = created;
+            }
+            state = matcher.next[state][c];
+        }
+        if (matcher.pattern[state] == -1)
+            matcher.pattern[state] = (int32_t) i;
+    }
+    if (empty)
+        throw std::runtime_error("No search patterns.\n");
+
+    std::queue<int32_t> queue;
+    for (auto &state: matcher.next[0]) {
+        if (state == -1)
+            state = 0;
+        else
+            queue.push(state);
+    }
+
+    while (!queue.empty()) {
+        auto state = queue.front();
+        queue.pop();
+
+        auto link = fail[state];
+        matcher.output_link[state] = matcher.pattern[link] != -1 ? link : matcher.output_link[link];
+
+        for (int c = 0; c < 256; ++c) {
+            auto &target = matcher.next[state][c];
+            if (target == -1)
+                target = matcher.next[link][c];
+            else {
+                fail[target] = matcher.next[link][c];
+                queue.push(target);
+            }
+        }
+    }
+
+    return matcher;
+}
+
+SearchResult search_archive(const std::string &filename, const PatternMatcher &matcher, bool first_match_only) {
+    /*
+     * Поиск в одном сжатом файле, декодированные данные никуда не пишутся.
+     * Смещения считаются в исходных (несжатых) данных.
+     * */
+
+    TRACE_SCOPE("search");
+
+    SearchResult result{};
+    result.filename = filename;
+
+    BIT_FILE *input = open_input_bit_file(filename.c_str());
+    if (input == nullptr) {
+        result.error = "Error open source file.";
+        return result;
+    }
+
+    auto tree = std::make_unique<Tree>();
+    try {
+        auto header = read_header(input);
+        Decoder decoder;
+        initialize_decoder(&decoder, tree.get(), input, header, filename);
+
+        int32_t state = 0;
+        int c;
+        while ((c = decode_next(&decoder)) != EOF) {
+            state = matcher.next[state][c];
+
+            auto found = matcher.pattern[state] != -1 ? state : matcher.output_link[state];
+            for (; found != -1; found = matcher.output_link[found]) {
+                auto pattern = (size_t) matcher.pattern[found];
+                if (result.matches.size() < SEARCH_MATCH_LIMIT)
+                    result.matches.push_back({pattern, decoder.position - matcher.lengths[pattern]});
+                ++result.match_count;
+            }
+            if (first_match_only && result.match_count != 0)
+                break;
+        }
+        result.decoded_size = decoder.position;
+        result.ok = true;
+    } catch (const std::runtime_error &e) {
+        result.error = e.what();
+        while (!result.error.empty() && result.error.back() == '\n')
+            result.error.pop_back();
+    }
+
+    close_input_bit_file(input);
+
+    return result;
+}
+
+std::vector<SearchResult> search_archives(const std::vector<std::string> &filenames,
+                                          const std::vector<std::string> &patterns,
+                                          bool first_match_only, unsigned threads) {
+    /*
+     * Параллельный поиск по нескольким сжатым файлам,
+     * так же как verify_archives: по задаче на файл,
+     * threads == 0 означает число ядер.
+     * */
+
+    auto matcher = build_matcher(patterns);
+    std::vector<SearchResult> results(filenames.size());
+    parallel_for(filenames.size(), [&](size_t i) {
+        TRACE_BLOCK((int64_t) i);
+        results[i] = search_archive(filenames[i], matcher, first_match_only);
+    }, threads);
+
+    return results;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef ZFCD_SEARCH_H
+#define ZFCD_SEARCH_H
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "HuffAdapt.h"
+
+/*
+ * Поиск в сжатых файлах без записи результата.
+ * Декодированные байты сразу подаются в автомат Ахо-Корасик,
+ * который за один проход находит вхождения всех образцов.
+ * */
+
+#define SEARCH_MATCH_LIMIT 0x10000 // Больше совпадений в одном файле не сохраняется
+
+struct PatternMatcher {
+    /*
+     * Автомат Ахо-Корасик с полной таблицей переходов:
+     * на каждый входной байт ровно одно обращение к таблице.
+     * */
+
+    std::vector<std::array<int32_t, 256>> next; /* Переходы, уже с учетом суффиксных ссылок */
+    std::vector<int32_t> pattern;               /* Образец, заканчивающийся в состоянии, или -1 */
+    std::vector<int32_t> output_link;           /* Ближайшее по суффиксным ссылкам состояние с образцом, или -1 */
+    std::vector<size_t> lengths;                /* Длины образцов */
+};
+
+struct SearchMatch {
+    size_t pattern;       /* Номер образца */
+    uint_fast64_t offset; /* Смещение начала совпадения в исходных данных */
+};
+
+struct SearchResult {
+    /*
+     * Результат поиска в одном сжатом файле
+     * */
+
+    std::string filename;
+    bool ok;                          /* TRUE, если файл прочитан без ошибок (до конца или до первого совпадения) */
+    std::string error;                /* Причина ошибки, если ok == FALSE */
+    std::vector<SearchMatch> matches; /* По возрастанию конца совпадения */
+    uint_fast64_t match_count;        /* Всего совпадений, может быть больше matches.size() */
+    uint_fast64_t decoded_size;       /* Декодировано байт */
+};
+
+PatternMatcher build_matcher(const std::vector<std::string> &patterns);
+
+SearchResult search_archive(const std::string &filename, const PatternMatcher &matcher, bool first_match_only = false);
+
+std::vector<SearchResult> search_archives(const std::vector<std::string> &filenames,
+                                          const std::vector<std::string> &patterns,
+                                          bool first_match_only = false, unsigned threads = 0);
+
+#endif //ZFCD_SEARCH_H
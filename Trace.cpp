@@ -0,0 +1,93 @@
+#include "Trace.h"
+
+#ifdef ZFCD_TRACE
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceBuffer {
+    /*
+     * События одного потока.
+     * Пишутся только своим потоком, поэтому без блокировок.
+     * */
+
+    int tid;                        /* Порядковый номер потока */
+    int64_t block;                  /* Текущий номер блока данных */
+    uint_fast64_t dropped;          /* События, не поместившиеся в буфер */
+    std::vector<TraceEvent> events;
+};
+
+static const auto trace_epoch = std::chrono::steady_clock::now(); // Начало отсчета времени событий
+static std::mutex trace_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> trace_buffers; // Буферы живут до конца программы
+
+static TraceBuffer *trace_buffer() {
+    /*
+     * Буфер текущего потока, регистрируется при первом обращении
+     * */
+
+    static thread_local TraceBuffer *buffer = nullptr;
+    if (buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_buffers.push_back(std::make_unique<TraceBuffer>());
+        buffer = trace_buffers.back().get();
+        buffer->tid = (int) trace_buffers.size();
+        buffer->block = -1;
+        buffer->dropped = 0;
+        buffer->events.reserve(4096);
+    }
+    return buffer;
+}
+
+void trace_record(const char *name,
+                  std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end) {
+    TraceBuffer *buffer = trace_buffer();
+    if (buffer->events.size() >= TRACE_EVENTS_PER_THREAD) {
+        ++buffer->dropped;
+        return;
+    }
+
+    std::chrono::duration<double, std::micro> since_epoch = start - trace_epoch;
+    std::chrono::duration<double, std::micro> duration = end - start;
+    buffer->events.push_back({name, since_epoch.count(), duration.count(), buffer->block});
+}
+
+void trace_set_block(int64_t block) {
+    trace_buffer()->block = block;
+}
+
+bool trace_dump(const char *name) {
+    /*
+     * Запись событий всех потоков в формате Chrome trace JSON.
+     * Вызывается, когда рабочие потоки не пишут события.
+     * */
+
+    FILE *output = fopen(name, "w");
+    if (output == nullptr)
+        return false;
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    fprintf(output, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"sample_rate\":%d},\"traceEvents\":[",
+            ZFCD_TRACE_SAMPLE_RATE);
+
+    bool first = true;
+    for (const auto &buffer: trace_buffers) {
+        fprintf(output, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                        "\"args\":{\"name\":\"worker %d (dropped %llu)\"}}",
+                first ? "" : ",", buffer->tid, buffer->tid, (unsigned long long) buffer->dropped);
+        first = false;
+
+        for (const auto &event: buffer->events)
+            fprintf(output, ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"block\":%lld}}",
+                    event.name, buffer->tid, event.start_us, event.duration_us, (long long) event.block);
+    }
+
+    fprintf(output, "]}\n");
+    return fclose(output) == 0;
+}
+
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#ifndef ZFCD_TRACE_H
+#define ZFCD_TRACE_H
+
+/*
+ * Профилирование в формате Chrome trace (chrome://tracing, ui.perfetto.dev).
+ * Включается при сборке опцией ZFCD_TRACING (определение ZFCD_TRACE),
+ * без нее все макросы раскрываются в пустые выражения.
+ *
+ * TRACE_SCOPE(name)         - событие на время жизни области видимости
+ * TRACE_SCOPE_SAMPLED(name) - то же, но записывается одно из ZFCD_TRACE_SAMPLE_RATE
+ *                             вызовов; для функций, вызываемых на каждый символ
+ * TRACE_BLOCK(id)           - номер блока данных, которым помечаются события потока
+ * TRACE_DUMP(name)          - запись накопленных событий в JSON файл
+ * */
+
+#ifdef ZFCD_TRACE
+
+#include <chrono>
+#include <cstdint>
+
+#ifndef ZFCD_TRACE_SAMPLE_RATE
+#define ZFCD_TRACE_SAMPLE_RATE 1024
+#endif
+
+#define TRACE_EVENTS_PER_THREAD (1 << 20) // Ограничение буфера событий одного потока
+
+struct TraceEvent {
+    /*
+     * Завершенное событие трассировки
+     * */
+
+    const char *name; /* Имя события, строковый литерал */
+    double start_us;  /* Начало, мкс от запуска программы */
+    double duration_us; /* Длительность, мкс */
+    int64_t block;    /* Номер блока данных, -1 если не задан */
+};
+
+void trace_record(const char *name,
+                  std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end);
+
+void trace_set_block(int64_t block);
+
+bool trace_dump(const char *name);
+
+class TraceScope {
+public:
+    explicit TraceScope(const char *name, bool enabled = true)
+            : name(enabled ? name : nullptr),
+              start(enabled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point()) {}
+
+    ~TraceScope() {
+        if (name != nullptr)
+            trace_record(name, start, std::chrono::steady_clock::now());
+    }
+
+    TraceScope(const TraceScope &) = delete;
+
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_SAMPLED(name)                                                    \
+    static thread_local uint_fast32_t TRACE_CONCAT(trace_sample_, __LINE__) = 0;     \
+    TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(                                 \
+            name, TRACE_CONCAT(trace_sample_, __LINE__)++ % ZFCD_TRACE_SAMPLE_RATE == 0)
+#define TRACE_BLOCK(id) trace_set_block(id)
+#define TRACE_DUMP(name) trace_dump(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void) 0)
+#define TRACE_SCOPE_SAMPLED(name) ((void) 0)
+#define TRACE_BLOCK(id) ((void) 0)
+#define TRACE_DUMP(name) ((void) 0)
+
+#endif
+
+#endif //ZFCD_TRACE_H
@@ -0,0 +1,127 @@
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <cstdint>
+
+WorkStealingPool::WorkStealingPool(unsigned threads) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned i = 0; i < threads; ++i)
+        workers.push_back(std::make_unique<Worker>());
+    for (unsigned i = 0; i < threads; ++i)
+        this->threads.emplace_back(&WorkStealingPool::run, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread: threads)
+        thread.join();
+}
+
+void WorkStealingPool::submit(std::vector<std::function<void()>> tasks) {
+    /*
+     * Постановка группы задач в самую короткую очередь,
+     * при равенстве потоки выбираются по кругу. Маленький файл
+     * не встает за сегментами большого, если есть очередь короче.
+     * */
+
+    if (tasks.empty())
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t chosen = next_worker++ % workers.size();
+    size_t shortest = SIZE_MAX;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        auto index = (chosen + i) % workers.size();
+        std::lock_guard<std::mutex> worker_lock(workers[index]->mutex);
+        if (workers[index]->tasks.size() < shortest) {
+            shortest = workers[index]->tasks.size();
+            chosen = index;
+        }
+    }
+    auto &worker = *workers[chosen];
+    {
+        std::lock_guard<std::mutex> worker_lock(worker.mutex);
+        for (auto &task: tasks)
+            worker.tasks.push_back(std::move(task));
+    }
+    queued += tasks.size();
+    pending += tasks.size();
+    wake.notify_all();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return pending == 0; });
+}
+
+unsigned WorkStealingPool::size() const {
+    return (unsigned) workers.size();
+}
+
+bool WorkStealingPool::pop(size_t self, std::function<void()> &task) {
+    /*
+     * Сначала своя очередь, затем чужие по кругу
+     * */
+
+    for (size_t i = 0; i < workers.size(); ++i) {
+        auto &worker = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> worker_lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(size_t self) {
+    std::function<void()> task;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (queued == 0)
+                return;
+            --queued;
+        }
+
+        /* Задача зарезервирована счетчиком queued, поэтому pop ее найдет */
+        pop(self, task);
+        task();
+        task = nullptr;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+            idle.notify_all();
+    }
+}
+
+void parallel_for(size_t count, const std::function<void(size_t)> &body, unsigned threads) {
+    /*
+     * Вызов body(i) для каждого i < count на временном пуле,
+     * threads == 0 означает число ядер, но не больше count.
+     * Возвращается после выполнения всех вызовов.
+     * */
+
+    if (count == 0)
+        return;
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    WorkStealingPool pool((unsigned) std::min<size_t>(threads, count));
+
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < count; ++i)
+        tasks.emplace_back([&body, i] { body(i); });
+    pool.submit(std::move(tasks));
+    pool.wait();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifndef ZFCD_WORKSTEALINGPOOL_H
+#define ZFCD_WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+    /*
+     * Пул потоков с очередью задач у каждого потока.
+     * Задачи одной группы (например, сегменты одного файла) попадают
+     * в самую короткую очередь, а освободившиеся потоки забирают
+     * задачи из чужих очередей. Поток и воры берут задачи с одного
+     * конца очереди, поэтому сегменты файла завершаются почти по порядку
+     * и ждут записи не больше нескольких сегментов на файл.
+     * */
+public:
+    explicit WorkStealingPool(unsigned threads = 0);
+
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    void submit(std::vector<std::function<void()>> tasks);
+
+    void wait();
+
+    unsigned size() const;
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake; /* Появились задачи или пул останавливается */
+    std::condition_variable idle; /* Все задачи выполнены */
+    size_t queued = 0;            /* Задачи в очередях, под mutex */
+    size_t pending = 0;           /* Задачи в очередях и в работе, под mutex */
+    size_t next_worker = 0;
+    bool stopping = false;
+
+    bool pop(size_t self, std::function<void()> &task);
+
+    void run(size_t self);
+};
+
+void parallel_for(size_t count, const std::function<void(size_t)> &body, unsigned threads = 0);
+
+#endif //ZFCD_WORKSTEALINGPOOL_H
@@ -1,13 +1,21 @@
 #include <QApplication>
 
 #include "MainWindow.h"
+#include "Trace.h"
 
 int main(int argc, char *argv[]) {
     QApplication a(argc, argv);
     QApplication::setStyle("fusion");
 
-    MainWindow window;
-    window.show();
+    int exit_code;
+    {
+        MainWindow window;
+        window.show();
 
-    return QApplication::exec();
+        exit_code = QApplication::exec();
+    } /* ~MainWindow дожидается потоков пакетной обработки, только потом буферы трассировки можно читать */
+
+    TRACE_DUMP(qEnvironmentVariable("ZFCD_TRACE_FILE", "zfcd-trace.json").toLocal8Bit().constData());
+
+    return exit_code;
 }
\ No newline at end of file